@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "dsp.h"
+
+#define DENORMAL_LIMIT 1e-15f // relative to full scale, far below the last bit of 24-bit audio
+
+const char *eq_type_names[EQ_TYPES] = {"high_pass", "high_shelf", "low_pass", "low_shelf", "peak"};
+
+static inline v4sf splat(float x) { return (v4sf){x, x, x, x}; }
+
+static inline int is_flat(const eq_band_t *band) {
+    return band->type != EQ_HIGH_PASS && band->type != EQ_LOW_PASS && band->gain == 0.0;
+}
+
+// Biquad coefficients after Robert Bristow-Johnson's Audio EQ Cookbook, normalized so that a0 is 1.
+static void design(biquad_t *s, const eq_band_t *band, int sample_rate) {
+    double a = pow(10, band->gain / 40);
+    double w0 = 2 * M_PI * band->frequency / sample_rate;
+    double cosw = cos(w0);
+    double alpha = sin(w0) / (2 * band->q);
+    double sqa = 2 * sqrt(a) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+    switch (band->type) {
+        case EQ_PEAK:
+            b0 = 1 + alpha * a;
+            b1 = -2 * cosw;
+            b2 = 1 - alpha * a;
+            a0 = 1 + alpha / a;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha / a;
+            break;
+        case EQ_LOW_SHELF:
+            b0 = a * ((a + 1) - (a - 1) * cosw + sqa);
+            b1 = 2 * a * ((a - 1) - (a + 1) * cosw);
+            b2 = a * ((a + 1) - (a - 1) * cosw - sqa);
+            a0 = (a + 1) + (a - 1) * cosw + sqa;
+            a1 = -2 * ((a - 1) + (a + 1) * cosw);
+            a2 = (a + 1) + (a - 1) * cosw - sqa;
+            break;
+        case EQ_HIGH_SHELF:
+            b0 = a * ((a + 1) + (a - 1) * cosw + sqa);
+            b1 = -2 * a * ((a - 1) + (a + 1) * cosw);
+            b2 = a * ((a + 1) + (a - 1) * cosw - sqa);
+            a0 = (a + 1) - (a - 1) * cosw + sqa;
+            a1 = 2 * ((a - 1) - (a + 1) * cosw);
+            a2 = (a + 1) - (a - 1) * cosw - sqa;
+            break;
+        case EQ_LOW_PASS:
+            b0 = (1 - cosw) / 2;
+            b1 = 1 - cosw;
+            b2 = (1 - cosw) / 2;
+            a0 = 1 + alpha;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha;
+            break;
+        default: // EQ_HIGH_PASS
+            b0 = (1 + cosw) / 2;
+            b1 = -(1 + cosw);
+            b2 = (1 + cosw) / 2;
+            a0 = 1 + alpha;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha;
+            break;
+    }
+    s->b0 = splat(b0 / a0);
+    s->b1 = splat(b1 / a0);
+    s->b2 = splat(b2 / a0);
+    s->a1 = splat(a1 / a0);
+    s->a2 = splat(a2 / a0);
+}
+
+static void update(dsp_t *dsp) {
+    int was_active[EQ_BANDS] = {0};
+    for (int i = 0; i < dsp->nactive; i++)
+        was_active[dsp->active[i]] = 1;
+    dsp->nactive = 0;
+    for (int i = 0; i < dsp->nbands; i++) {
+        if (is_flat(&dsp->bands[i]))
+            continue;
+        if (dsp->dirty & 1u << i)
+            design(&dsp->sections[i], &dsp->bands[i], dsp->sample_rate);
+        // A band that was bypassed has stale history from before it was.
+        if (!was_active[i])
+            dsp->sections[i].z1 = dsp->sections[i].z2 = splat(0);
+        dsp->active[dsp->nactive++] = i;
+    }
+    dsp->dirty = 0;
+}
+
+void dsp_init(dsp_t *dsp, int sample_rate) {
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->sample_rate = sample_rate;
+    dsp->gain = 1.0f;
+}
+
+int dsp_set_band(dsp_t *dsp, uint32_t index, enum eq_type type, double frequency, double gain, double q) {
+    if (index > (uint32_t)dsp->nbands || index >= EQ_BANDS || type >= EQ_TYPES || !(frequency > 0) ||
+        !(frequency < dsp->sample_rate / 2.0) || !(fabs(gain) <= EQ_MAX_GAIN) || !(q >= 0.1 && q <= 100))
+        return 1;
+    if (index == (uint32_t)dsp->nbands) {
+        dsp->nbands++;
+        dsp->sections[index].z1 = dsp->sections[index].z2 = splat(0);
+    }
+    dsp->bands[index] = (eq_band_t){type, frequency, gain, q};
+    dsp->dirty |= 1u << index;
+    return 0;
+}
+
+int dsp_remove_band(dsp_t *dsp, uint32_t index) {
+    if (index >= (uint32_t)dsp->nbands)
+        return 1;
+    int after = dsp->nbands - index - 1;
+    memmove(&dsp->bands[index], &dsp->bands[index + 1], after * sizeof(eq_band_t));
+    memmove(&dsp->sections[index], &dsp->sections[index + 1], after * sizeof(biquad_t));
+    dsp->nbands--;
+    // The bands that moved keep their coefficients and history, only the bookkeeping follows them.
+    uint32_t below = (1u << index) - 1;
+    dsp->dirty = (dsp->dirty & below) | (dsp->dirty >> 1 & ~below);
+    int kept = 0;
+    for (int i = 0; i < dsp->nactive; i++) {
+        if (dsp->active[i] != (int)index)
+            dsp->active[kept++] = dsp->active[i] - (dsp->active[i] > (int)index);
+    }
+    dsp->nactive = kept;
+    return 0;
+}
+
+int dsp_set_preamp(dsp_t *dsp, double preamp) {
+    if (!(fabs(preamp) <= EQ_MAX_GAIN))
+        return 1;
+    dsp->preamp = preamp;
+    dsp->gain = pow(10, preamp / 20);
+    return 0;
+}
+
+void dsp_set_enabled(dsp_t *dsp, int enabled) {
+    if (enabled && !dsp->enabled)
+        dsp_reset(dsp);
+    dsp->enabled = enabled;
+}
+
+void dsp_reset(dsp_t *dsp) {
+    for (int i = 0; i < dsp->nbands; i++)
+        dsp->sections[i].z1 = dsp->sections[i].z2 = splat(0);
+}
+
+static inline v4sf flush_denormal(v4sf z) {
+    v4si tiny = (z < splat(DENORMAL_LIMIT)) & (z > splat(-DENORMAL_LIMIT));
+    return (v4sf)((v4si)z & ~tiny);
+}
+
+void dsp_process(dsp_t *dsp, float *pcm, int frames) {
+    if (!dsp->enabled)
+        return;
+    if (dsp->dirty)
+        update(dsp);
+    if (!dsp->nactive && dsp->gain == 1.0f)
+        return;
+
+    // Sections are copied to locals so that the compiler can keep them in registers across the whole block.
+    biquad_t s[EQ_BANDS];
+    int n = dsp->nactive;
+    for (int i = 0; i < n; i++)
+        s[i] = dsp->sections[dsp->active[i]];
+    const v4sf gain = splat(dsp->gain);
+    for (int f = 0; f < frames; f++, pcm += CHANNELS) {
+        v4sf x = splat(0);
+        memcpy(&x, pcm, CHANNELS * sizeof(float));
+        for (int i = 0; i < n; i++) {
+            v4sf y = s[i].b0 * x + s[i].z1;
+            s[i].z1 = s[i].b1 * x - s[i].a1 * y + s[i].z2;
+            s[i].z2 = s[i].b2 * x - s[i].a2 * y;
+            x = y;
+        }
+        x *= gain;
+        memcpy(pcm, &x, CHANNELS * sizeof(float));
+    }
+    for (int i = 0; i < n; i++) {
+        s[i].z1 = flush_denormal(s[i].z1);
+        s[i].z2 = flush_denormal(s[i].z2);
+        dsp->sections[dsp->active[i]] = s[i];
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_DSP_H
+#define TINYAUDIO_DSP_H
+
+#include <stdint.h>
+
+#include "tinyaudio.h"
+
+#define DSP_LANES 4 // one vector lane per channel
+#define EQ_BANDS 10
+#define EQ_MAX_GAIN 24.0 // dB, for bands and the preamp alike
+
+_Static_assert(CHANNELS <= DSP_LANES, "every channel needs a vector lane");
+
+// Ordered by name so that names can be looked up with binsearch.
+enum eq_type { EQ_HIGH_PASS, EQ_HIGH_SHELF, EQ_LOW_PASS, EQ_LOW_SHELF, EQ_PEAK, EQ_TYPES };
+
+extern const char *eq_type_names[EQ_TYPES];
+
+typedef struct {
+    enum eq_type type;
+    double frequency; // Hz
+    double gain;      // dB, ignored by the pass filters
+    double q;
+} eq_band_t;
+
+// A second order section in transposed direct form II. Coefficients are splatted across the lanes, so one vector
+// operation filters a sample of every channel.
+typedef struct {
+    v4sf b0, b1, b2, a1, a2;
+    v4sf z1, z2;
+} biquad_t;
+
+// NOTE: the chain runs on the main thread, between the resampler and the output stage, and filters float audio in
+// place without clipping, which is left to the output stage. Parameters only mark their band dirty, its coefficients
+// are worked out by the next dsp_process. Bands that leave the signal unchanged (peaks and shelves at 0 dB) are not run
+// at all, and a chain with none left costs nothing.
+typedef struct {
+    int enabled;
+    double preamp; // dB
+    eq_band_t bands[EQ_BANDS];
+    biquad_t sections[EQ_BANDS]; // one per band, so that a band keeps its history while others change
+    int nbands;
+    int sample_rate;
+    uint32_t dirty; // one bit per band
+    int active[EQ_BANDS];
+    int nactive;
+    float gain; // linear preamp
+} dsp_t;
+
+void dsp_init(dsp_t *dsp, int sample_rate);
+// Returns 1 if the band is out of range: index past the end of the bands, frequency not below Nyquist, and so on. An
+// index equal to the number of bands appends one.
+int dsp_set_band(dsp_t *dsp, uint32_t index, enum eq_type type, double frequency, double gain, double q);
+int dsp_remove_band(dsp_t *dsp, uint32_t index);
+int dsp_set_preamp(dsp_t *dsp, double preamp);
+void dsp_set_enabled(dsp_t *dsp, int enabled);
+// Forgets the filter history, for when the audio that follows is unrelated to what came before.
+void dsp_reset(dsp_t *dsp);
+void dsp_process(dsp_t *dsp, float *pcm, int frames);
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE // qsort_r
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+
+#include "library.h"
+#include "strtab.h"
+#include "tinyaudio.h"
+#include "xdg.h"
+
+#define MAX_SCAN_THREADS 16
+#define MAX_SCAN_DEPTH 32
+
+typedef struct {
+    char *text[LIBRARY_FIELDS];
+    int64_t mtime; // ns, so that a file rewritten within a second of a scan is probed again
+    int probe;
+} entry_t;
+
+typedef struct {
+    entry_t *entries;
+    uint32_t len;
+    uint32_t cap;
+    atomic_uint next;
+} scan_t;
+
+const char *library_default_path() {
+    static char path[4096];
+    return xdg_path(path, sizeof(path), XDG_CACHE, "library.idx");
+}
+
+static int section_valid(const library_header_t *header, uint64_t offset, uint64_t count, size_t size) {
+    return offset % 8 == 0 && offset <= header->size && count <= (header->size - offset) / size;
+}
+
+int library_open(library_t *lib, const char *path) {
+    memset(lib, 0, sizeof(*lib));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(library_header_t)) {
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    const library_header_t *header = map;
+    int valid = memcmp(header->magic, LIBRARY_MAGIC, sizeof(header->magic)) == 0 &&
+                header->version == LIBRARY_VERSION && header->size == (uint64_t)st.st_size &&
+                section_valid(header, header->strings, header->strings_size, 1) && header->strings_size > 0 &&
+                ((const char *)map)[header->strings + header->strings_size - 1] == 0 &&
+                section_valid(header, header->roots, header->nroots, sizeof(uint32_t)) &&
+                section_valid(header, header->mtimes, header->count, sizeof(int64_t));
+    for (int i = 0; i < LIBRARY_FIELDS; i++) {
+        valid = valid && section_valid(header, header->columns[i], header->count, sizeof(uint32_t)) &&
+                section_valid(header, header->sorted[i], header->count, sizeof(uint32_t));
+    }
+    // Sorted columns are used as row numbers without further checks, so a damaged one must not get past here.
+    for (int i = 0; valid && i < LIBRARY_FIELDS; i++) {
+        const uint32_t *sorted = (const uint32_t *)((const uint8_t *)map + header->sorted[i]);
+        for (uint32_t row = 0; valid && row < header->count; row++)
+            valid = sorted[row] < header->count;
+    }
+    if (!valid) {
+        syslog(LOG_WARNING, "Ignoring invalid library index %s\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    const uint8_t *base = map;
+    lib->map = map;
+    lib->size = st.st_size;
+    lib->count = header->count;
+    lib->strings = (const char *)base + header->strings;
+    lib->strings_size = header->strings_size;
+    lib->roots = (const uint32_t *)(base + header->roots);
+    lib->nroots = header->nroots;
+    lib->mtimes = (const int64_t *)(base + header->mtimes);
+    for (int i = 0; i < LIBRARY_FIELDS; i++) {
+        lib->columns[i] = (const uint32_t *)(base + header->columns[i]);
+        lib->sorted[i] = (const uint32_t *)(base + header->sorted[i]);
+    }
+    return 0;
+}
+
+void library_close(library_t *lib) {
+    if (lib->map)
+        munmap((void *)lib->map, lib->size);
+    memset(lib, 0, sizeof(*lib));
+}
+
+// Returns the number of rows whose field starts with prefix (ignoring case) and stores the position of the first one
+// in the sorted column of that field.
+uint32_t library_find(const library_t *lib, enum library_field field, const char *prefix, uint32_t *first) {
+    const uint32_t *sorted = lib->sorted[field];
+    size_t len = strlen(prefix);
+    uint32_t lo = 0, hi = lib->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strncasecmp(library_field(lib, sorted[mid], field), prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *first = lo;
+    hi = lo;
+    while (hi < lib->count && strncasecmp(library_field(lib, sorted[hi], field), prefix, len) == 0)
+        hi++;
+    return hi - lo;
+}
+
+static uint32_t library_lookup(const library_t *lib, const char *path) {
+    uint32_t first;
+    uint32_t n = library_find(lib, FIELD_PATH, path, &first);
+    for (uint32_t i = first; i < first + n; i++) {
+        uint32_t row = lib->sorted[FIELD_PATH][i];
+        if (strcmp(library_field(lib, row, FIELD_PATH), path) == 0)
+            return row;
+    }
+    return UINT32_MAX;
+}
+
+static int is_audio_file(const char *name) {
+    static const char *extensions[] = {"aac",  "aif", "aiff", "alac", "ape", "flac", "m4a", "mka", "mp2",
+                                       "mp3",  "mpc", "oga",  "ogg",  "opus", "spx", "tta", "wav", "wma",
+                                       "wv"};
+    const char *dot = strrchr(name, '.');
+    if (!dot)
+        return 0;
+    for (unsigned int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot + 1, extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int scan_add(scan_t *scan, const char *path, int64_t mtime) {
+    if (scan->len == scan->cap) {
+        uint32_t cap = scan->cap ? scan->cap * 2 : 1024;
+        entry_t *entries = realloc(scan->entries, cap * sizeof(entry_t));
+        if (!entries)
+            return 1;
+        scan->entries = entries;
+        scan->cap = cap;
+    }
+    entry_t *entry = &scan->entries[scan->len];
+    memset(entry, 0, sizeof(*entry));
+    entry->text[FIELD_PATH] = strdup(path);
+    if (!entry->text[FIELD_PATH])
+        return 1;
+    entry->mtime = mtime;
+    scan->len++;
+    return 0;
+}
+
+static int walk(scan_t *scan, const char *dir, int depth) {
+    if (depth > MAX_SCAN_DEPTH)
+        return 0;
+    DIR *d = opendir(dir);
+    if (!d) {
+        syslog(LOG_WARNING, "Cannot read directory %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+    int result = 0;
+    struct dirent *de;
+    while (result == 0 && (de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        char path[4096];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path))
+            continue;
+        struct stat st;
+        if (stat(path, &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            result = walk(scan, path, depth + 1);
+        else if (S_ISREG(st.st_mode) && is_audio_file(de->d_name))
+            result = scan_add(scan, path, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+    }
+    closedir(d);
+    return result;
+}
+
+static void read_tags(entry_t *entry) {
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, entry->text[FIELD_PATH], NULL, NULL) < 0)
+        return;
+
+    static const struct {
+        const char *xesam;
+        enum library_field field;
+    } fields[] = {{"xesam:album", FIELD_ALBUM}, {"xesam:artist", FIELD_ARTIST}, {"xesam:title", FIELD_TITLE}};
+    for (int i = -1; i < (int)fmt->nb_streams; i++) {
+        // Container tags first, then those of the audio streams (Ogg keeps its comments there).
+        if (i >= 0 && fmt->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+            continue;
+        const AVDictionary *metadata = i < 0 ? fmt->metadata : fmt->streams[i]->metadata;
+        const AVDictionaryEntry *tag = NULL;
+        while ((tag = av_dict_iterate(metadata, tag))) {
+            char key[32];
+            size_t n;
+            for (n = 0; tag->key[n] && n < sizeof(key) - 1; n++)
+                key[n] = tolower((unsigned char)tag->key[n]);
+            key[n] = 0;
+            const char *xesam = tag2xesam(key);
+            for (unsigned int f = 0; xesam && f < sizeof(fields) / sizeof(fields[0]); f++) {
+                if (strcmp(xesam, fields[f].xesam) == 0 && !entry->text[fields[f].field])
+                    entry->text[fields[f].field] = strdup(tag->value);
+            }
+        }
+    }
+    avformat_close_input(&fmt);
+}
+
+static void *scan_worker(void *arg) {
+    scan_t *scan = arg;
+    uint32_t i;
+    while ((i = atomic_fetch_add(&scan->next, 1)) < scan->len) {
+        if (scan->entries[i].probe)
+            read_tags(&scan->entries[i]);
+    }
+    return NULL;
+}
+
+static int compare_rows(const void *a, const void *b, void *arg) {
+    const char **column = arg;
+    return strcasecmp(column[*(const uint32_t *)a], column[*(const uint32_t *)b]);
+}
+
+static int write_index(const char *path, scan_t *scan, const char *const *roots, uint32_t nroots) {
+    strtab_t strings = {0};
+    uint32_t count = scan->len;
+    uint32_t *columns = malloc((size_t)count * LIBRARY_FIELDS * sizeof(uint32_t));
+    uint32_t *sorted = malloc((size_t)count * LIBRARY_FIELDS * sizeof(uint32_t));
+    uint32_t *root_offsets = malloc((nroots + 1) * sizeof(uint32_t));
+    int64_t *mtimes = malloc((count + 1) * sizeof(int64_t));
+    const char **text = malloc((count + 1) * sizeof(char *));
+    int result = 1;
+    if (!columns || !sorted || !root_offsets || !mtimes || !text)
+        goto out;
+
+    strtab_reset(&strings);
+    for (uint32_t r = 0; r < nroots; r++) {
+        if ((root_offsets[r] = strtab_intern(&strings, roots[r])) == STRTAB_ERROR)
+            goto out;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        mtimes[i] = scan->entries[i].mtime;
+        for (int f = 0; f < LIBRARY_FIELDS; f++) {
+            uint32_t offset = strtab_intern(&strings, scan->entries[i].text[f]);
+            if (offset == STRTAB_ERROR)
+                goto out;
+            columns[f * count + i] = offset;
+        }
+    }
+    for (int f = 0; f < LIBRARY_FIELDS; f++) {
+        uint32_t *order = sorted + f * count;
+        for (uint32_t i = 0; i < count; i++) {
+            order[i] = i;
+            text[i] = strtab_get(&strings, columns[f * count + i]);
+        }
+        qsort_r(order, count, sizeof(uint32_t), compare_rows, text);
+    }
+
+    library_header_t header = {0};
+    memcpy(header.magic, LIBRARY_MAGIC, sizeof(header.magic));
+    header.version = LIBRARY_VERSION;
+    header.count = count;
+    header.nroots = nroots;
+    uint64_t offset = sizeof(header);
+    header.mtimes = offset;
+    offset += (uint64_t)count * sizeof(int64_t);
+    for (int f = 0; f < LIBRARY_FIELDS; f++) {
+        header.columns[f] = offset;
+        offset += (uint64_t)count * sizeof(uint32_t);
+        header.sorted[f] = offset;
+        offset += (uint64_t)count * sizeof(uint32_t);
+    }
+    header.roots = offset;
+    offset += (uint64_t)nroots * sizeof(uint32_t);
+    size_t padding_size = ((offset + 7) & ~(uint64_t)7) - offset;
+    offset += padding_size;
+    header.strings = offset;
+    header.strings_size = strings.len;
+    header.size = offset + strings.len;
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        syslog(LOG_ERR, "Cannot write library index %s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+    static const char padding[8];
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(mtimes, sizeof(int64_t), count, f) == count;
+    for (int i = 0; ok && i < LIBRARY_FIELDS; i++) {
+        ok = fwrite(columns + i * count, sizeof(uint32_t), count, f) == count &&
+             fwrite(sorted + i * count, sizeof(uint32_t), count, f) == count;
+    }
+    ok = ok && fwrite(root_offsets, sizeof(uint32_t), nroots, f) == nroots &&
+         fwrite(padding, 1, padding_size, f) == padding_size &&
+         fwrite(strings.strings, 1, strings.len, f) == strings.len;
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp, path) == 0) {
+        sync_parent_dir(path);
+        result = 0;
+    } else {
+        syslog(LOG_ERR, "Failed to write library index %s\n", path);
+        unlink(tmp);
+    }
+
+out:
+    strtab_free(&strings);
+    free(columns);
+    free(sorted);
+    free(root_offsets);
+    free(mtimes);
+    free(text);
+    return result;
+}
+
+// Rebuilds the index at path from the audio files below roots, or below the roots of the existing index when none
+// are given. Files whose modification time has not changed keep the tags recorded in the existing index, the rest
+// are probed on a pool of threads.
+int library_scan(const char *path, const char *const *roots, uint32_t nroots) {
+    library_t old;
+    int have_old = library_open(&old, path) == 0;
+    const char **old_roots = NULL;
+    if (nroots == 0 && have_old && old.nroots > 0) {
+        old_roots = malloc(old.nroots * sizeof(char *));
+        if (old_roots) {
+            for (uint32_t r = 0; r < old.nroots; r++)
+                old_roots[r] = library_string(&old, old.roots[r]);
+            roots = old_roots;
+            nroots = old.nroots;
+        }
+    }
+
+    scan_t scan = {0};
+    int result = 0;
+    for (uint32_t r = 0; result == 0 && r < nroots; r++)
+        result = walk(&scan, roots[r], 0);
+
+    uint32_t probes = 0;
+    for (uint32_t i = 0; result == 0 && i < scan.len; i++) {
+        entry_t *entry = &scan.entries[i];
+        uint32_t row = have_old ? library_lookup(&old, entry->text[FIELD_PATH]) : UINT32_MAX;
+        if (row != UINT32_MAX && old.mtimes[row] == entry->mtime) {
+            for (int f = FIELD_PATH + 1; f < LIBRARY_FIELDS; f++) {
+                const char *value = library_field(&old, row, f);
+                entry->text[f] = *value ? strdup(value) : NULL;
+            }
+        } else {
+            entry->probe = 1;
+            probes++;
+        }
+    }
+
+    if (result == 0 && probes > 0) {
+        long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nthreads < 1)
+            nthreads = 1;
+        if (nthreads > MAX_SCAN_THREADS)
+            nthreads = MAX_SCAN_THREADS;
+        if (nthreads > probes)
+            nthreads = probes;
+        pthread_t threads[MAX_SCAN_THREADS];
+        long started = 0;
+        while (started < nthreads && pthread_create(&threads[started], NULL, scan_worker, &scan) == 0)
+            started++;
+        if (started == 0)
+            scan_worker(&scan);
+        for (long t = 0; t < started; t++)
+            pthread_join(threads[t], NULL);
+    }
+
+    if (result == 0) {
+        make_parent_dirs(path);
+        result = write_index(path, &scan, roots, nroots);
+    }
+    if (result == 0)
+        syslog(LOG_INFO, "Indexed %u files, %u of them probed\n", scan.len, probes);
+
+    for (uint32_t i = 0; i < scan.len; i++) {
+        for (int f = 0; f < LIBRARY_FIELDS; f++)
+            free(scan.entries[i].text[f]);
+    }
+    free(scan.entries);
+    free(old_roots);
+    if (have_old)
+        library_close(&old);
+    return result;
+}
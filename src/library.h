@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYAUDIO_LIBRARY_H
+#define TINYAUDIO_LIBRARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIBRARY_MAGIC "TALIBIDX"
+#define LIBRARY_VERSION 2 // 2: mtimes in nanoseconds
+
+enum library_field { FIELD_PATH, FIELD_ARTIST, FIELD_ALBUM, FIELD_TITLE, LIBRARY_FIELDS };
+
+// On-disk layout of the index. Every section is an array of fixed size elements so that the mapping can be used as
+// is: text columns hold offsets into the string table, sorted columns hold row numbers ordered by the text of the
+// corresponding column (case-insensitively), and roots are the string offsets of the scanned directories.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t nroots;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t strings;
+    uint64_t strings_size;
+    uint64_t roots;
+    uint64_t mtimes;
+    uint64_t columns[LIBRARY_FIELDS];
+    uint64_t sorted[LIBRARY_FIELDS];
+} library_header_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t size;
+    uint32_t count;
+    const char *strings;
+    uint64_t strings_size;
+    const int64_t *mtimes;
+    const uint32_t *roots;
+    uint32_t nroots;
+    const uint32_t *columns[LIBRARY_FIELDS];
+    const uint32_t *sorted[LIBRARY_FIELDS];
+} library_t;
+
+const char *library_default_path();
+int library_open(library_t *lib, const char *path);
+void library_close(library_t *lib);
+int library_scan(const char *path, const char *const *roots, uint32_t nroots);
+
+static inline const char *library_string(const library_t *lib, uint32_t offset) {
+    return offset < lib->strings_size ? lib->strings + offset : "";
+}
+
+static inline const char *library_field(const library_t *lib, uint32_t row, enum library_field field) {
+    return library_string(lib, lib->columns[field][row]);
+}
+
+uint32_t library_find(const library_t *lib, enum library_field field, const char *prefix, uint32_t *first);
+
+#endif
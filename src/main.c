@@ -23,14 +23,21 @@
  */
 
 #include <assert.h>
+#include <getopt.h>
 #include <libavutil/dict.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include <sys/resource.h>
 #include <sys/syslog.h>
 #include <sys/types.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <dbus/dbus-protocol.h>
@@ -46,21 +53,60 @@
 #include <libavutil/log.h>
 #include <libavutil/mathematics.h>
 #include <libavutil/opt.h>
+#include <libavutil/random_seed.h>
 #include <libavutil/rational.h>
 #include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
 #include <libswresample/swresample.h>
 
 #include <pulse/simple.h>
 
-#define SAMPLE_RATE 44100
-#define CHANNELS 2
+#include "dsp.h"
+#include "library.h"
+#include "output.h"
+#include "playlist.h"
+#include "reconnect.h"
+#include "recorder.h"
+#include "resample.h"
+#include "rtp.h"
+#include "state.h"
+#include "tap.h"
+#include "timeshift.h"
+#include "tinyaudio.h"
+
+#define FRAME_BYTES (sizeof(float) * CHANNELS) // of the audio between the resampler and the output stage
+
+// NOTE: in burst mode local files are decoded BURST_SECONDS at a time straight into a preallocated buffer and handed
+// to the sink in one write. The buffer has BURST_HEADROOM on top, so that the frame that fills a burst always fits.
+// A burst is only written once the sink has room for all of it, which is when no more than BURST_LOW_WATERMARK of
+// audio is left, so the write never blocks and the process sleeps in poll() in between, serving D-Bus.
+#define BURST_SECONDS 15
+#define BURST_HEADROOM 1            // seconds
+#define BURST_LOW_WATERMARK 5000000 // usec
+#define BURST_PREBUF 100000         // usec, what starts playback
+#define BURST_SINK_LENGTH ((BURST_SECONDS + BURST_HEADROOM) * 1000000LL + BURST_LOW_WATERMARK) // usec
+#define WAKEUP_REPORT_INTERVAL 10000000 // usec
+#define CLOCK_SYNC_INTERVAL 500000       // usec
+#define CHECKPOINT_INTERVAL 10000000     // usec, how old the saved position can get while playing
 
-#define APP_NAME "tinyaudio"
 #define BUS_NAME "org.mpris.MediaPlayer2.tinyaudio"
 #define IFACE_ROOT "org.mpris.MediaPlayer2"
 #define IFACE_PLAYER "org.mpris.MediaPlayer2.Player"
+#define IFACE_TRACKLIST "org.mpris.MediaPlayer2.TrackList"
+#define IFACE_LIBRARY "org.mpris.MediaPlayer2.tinyaudio.Library"
+#define IFACE_TINYAUDIO "org.mpris.MediaPlayer2.tinyaudio"
+#define IFACE_EQUALIZER "org.mpris.MediaPlayer2.tinyaudio.Equalizer"
 #define OBJ_PATH "/org/mpris/MediaPlayer2"
 #define NO_TRACK "/TrackList/NoTrack"
+#define TRACK_PREFIX "/Track/"
+// NOTE: Tracks only ever lists this many entries around the current one.
+#define TRACKLIST_PAGE_SIZE 64
+// NOTE: Probing runs on the thread that feeds the sink, so GetTracksMetadata opens at most this many uncached files
+// per call. Anything beyond that is answered from what the playlist itself says about the track, and a client paging
+// through the list fills the cache a few tracks at a time.
+#define METADATA_PROBES_PER_CALL 4
+#define METADATA_CACHE_SIZE 64
+#define TAP_MAX_CLIENTS 16
 #define XML_DATA                                                                                                       \
     "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\" "                                \
     "\"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\"><node "                                          \
@@ -74,18 +120,53 @@
     "name=\"org.mpris.MediaPlayer2.Player\"><method name=\"Play\"/><method name=\"Pause\"/><method "                   \
     "name=\"Stop\"/><method name=\"PlayPause\"/><method name=\"Next\"/><method name=\"Previous\"/><method "            \
     "name=\"Seek\"><arg name=\"offset\" type=\"x\" direction=\"in\"/></method><method "                                \
-    "name=\"SetPosition\"><arg name=\"track_id\" type=\"x\" direction=\"in\"/><arg name=\"position\" "                 \
-    "type=\"Seeked\" direction=\"in\"/></method><method name=\"OpenUri\"><arg name=\"uri\" type=\"Rate\" "             \
+    "name=\"SetPosition\"><arg name=\"track_id\" type=\"o\" direction=\"in\"/><arg name=\"position\" "                 \
+    "type=\"x\" direction=\"in\"/></method><method name=\"OpenUri\"><arg name=\"uri\" type=\"s\" "                     \
     "direction=\"in\"/></method><property name=\"PlaybackStatus\" type=\"s\" access=\"read\"/><property "              \
     "name=\"Rate\" type=\"d\" access=\"readwrite\"/><property name=\"Shuffle\" type=\"b\" "                            \
     "access=\"readwrite\"/><property name=\"LoopStatus\" type=\"s\" access=\"readwrite\"/><property "                  \
-    "name=\"Position\" type=\"x\" access=\"readwrite\"/><property name=\"MinimumRate\" type=\"d\" "                    \
+    "name=\"Position\" type=\"x\" access=\"read\"/><property name=\"MinimumRate\" type=\"d\" "                         \
     "access=\"read\"/><property name=\"MaximumRate\" type=\"d\" access=\"read\"/><property name=\"CanGoNext\" "        \
     "type=\"b\" access=\"read\"/><property name=\"CanGoPrevious\" type=\"b\" access=\"read\"/><property "              \
     "name=\"CanPlay\" type=\"b\" access=\"read\"/><property name=\"CanPause\" type=\"b\" "                             \
     "access=\"read\"/><property name=\"CanSeek\" type=\"b\" access=\"read\"/><property name=\"CanControl\" "           \
     "type=\"b\" access=\"read\"/><signal name=\"Seeked\"><arg name=\"Position\" "                                      \
-    "type=\"x\"/></signal></interface><interface name=\"org.freedesktop.DBus.Properties\"><method "                    \
+    "type=\"x\"/></signal></interface><interface name=\"org.mpris.MediaPlayer2.TrackList\"><method "                   \
+    "name=\"GetTracksMetadata\"><arg name=\"TrackIds\" type=\"ao\" direction=\"in\"/><arg name=\"Metadata\" "          \
+    "type=\"aa{sv}\" direction=\"out\"/></method><method name=\"AddTrack\"><arg name=\"Uri\" type=\"s\" "              \
+    "direction=\"in\"/><arg name=\"AfterTrack\" type=\"o\" direction=\"in\"/><arg name=\"SetAsCurrent\" type=\"b\" "   \
+    "direction=\"in\"/></method><method name=\"RemoveTrack\"><arg name=\"TrackId\" type=\"o\" "                        \
+    "direction=\"in\"/></method><method name=\"GoTo\"><arg name=\"TrackId\" type=\"o\" direction=\"in\"/></method>"    \
+    "<property name=\"Tracks\" type=\"ao\" access=\"read\"/><property name=\"CanEditTracks\" type=\"b\" "              \
+    "access=\"read\"/><signal name=\"TrackListReplaced\"><arg name=\"Tracks\" type=\"ao\"/><arg "                      \
+    "name=\"CurrentTrack\" type=\"o\"/></signal></interface><interface "                                               \
+    "name=\"org.mpris.MediaPlayer2.tinyaudio.Library\"><method name=\"Scan\"><arg name=\"Directories\" "               \
+    "type=\"as\" direction=\"in\"/></method><method name=\"Search\"><arg name=\"Field\" type=\"s\" "                   \
+    "direction=\"in\"/><arg name=\"Prefix\" type=\"s\" direction=\"in\"/><arg name=\"Limit\" type=\"u\" "              \
+    "direction=\"in\"/><arg name=\"Tracks\" type=\"a(ssss)\" direction=\"out\"/></method><signal "                     \
+    "name=\"Updated\"><arg name=\"Count\" type=\"u\"/></signal></interface><interface "                                \
+    "name=\"org.mpris.MediaPlayer2.tinyaudio\"><property name=\"ReconnectCount\" type=\"u\" access=\"read\"/>"         \
+    "<property name=\"LastGap\" type=\"x\" access=\"read\"/><property name=\"TotalGap\" type=\"x\" "                   \
+    "access=\"read\"/><property name=\"BurstMode\" type=\"b\" access=\"read\"/><property "                             \
+    "name=\"WakeupsPerSecond\" type=\"d\" access=\"read\"/><property name=\"Resampler\" type=\"s\" "                   \
+    "access=\"readwrite\"/><method name=\"OpenTap\"><arg name=\"Memory\" type=\"h\" direction=\"out\"/></method>"      \
+    "<method name=\"CloseTap\"/><method name=\"StartRecording\"><arg name=\"Path\" type=\"s\" direction=\"in\"/>"      \
+    "<arg name=\"SplitOnTitle\" type=\"b\" direction=\"in\"/></method><method name=\"StopRecording\"/>"                \
+    "<property name=\"Recording\" type=\"s\" access=\"read\"/><property name=\"RecordingDropped\" type=\"u\" "         \
+    "access=\"read\"/><property name=\"Timeshift\" type=\"b\" access=\"read\"/><property "                             \
+    "name=\"TimeshiftDelay\" type=\"x\" access=\"read\"/><property name=\"TimeshiftWindow\" type=\"x\" "               \
+    "access=\"read\"/><property name=\"RtpReceivers\" type=\"u\" access=\"read\"/><property name=\"RtpSkew\" "         \
+    "type=\"x\" access=\"read\"/><property name=\"RtpDelay\" type=\"x\" access=\"read\"/><property "                   \
+    "name=\"SampleFormat\" type=\"s\" access=\"read\"/><property name=\"Dither\" type=\"s\" "                          \
+    "access=\"readwrite\"/></interface><interface "                                                                    \
+    "name=\"org.mpris.MediaPlayer2.tinyaudio.Equalizer\"><method "                                                     \
+    "name=\"SetBand\"><arg name=\"Index\" type=\"u\" direction=\"in\"/><arg name=\"Type\" type=\"s\" "                 \
+    "direction=\"in\"/><arg name=\"Frequency\" type=\"d\" direction=\"in\"/><arg name=\"Gain\" type=\"d\" "            \
+    "direction=\"in\"/><arg name=\"Q\" type=\"d\" direction=\"in\"/></method><method name=\"RemoveBand\"><arg "        \
+    "name=\"Index\" type=\"u\" direction=\"in\"/></method><property name=\"Enabled\" type=\"b\" "                      \
+    "access=\"readwrite\"/><property name=\"Preamp\" type=\"d\" access=\"readwrite\"/><property name=\"Bands\" "       \
+    "type=\"a(sddd)\" access=\"read\"/></interface><interface "                                                        \
+    "name=\"org.freedesktop.DBus.Properties\"><method "                                                                \
     "name=\"Get\"/><method name=\"Set\"/><method name=\"GetAll\"/></interface><interface "                             \
     "name=\"org.freedesktop.DBus.Introspectable\"><method name=\"Introspect\"/></interface></node>";
 
@@ -113,11 +194,15 @@
 #define STRING_PAUSED "Paused";
 #define STRING_STOPPED "Stopped";
 
+static const char loop_none[] = "None", loop_playlist[] = "Playlist", loop_track[] = "Track";
+static const char *loop_statuses[] = {loop_none, loop_playlist, loop_track};
+
 typedef struct {
     AVFormatContext *fmt;
     int astream;
     AVCodecContext *cc;
     SwrContext *swr;
+    AVDictionary *metadata; // while timeshifting: the stream metadata of what is playing, fmt's is the live one
 } ffmpegparams_t;
 
 typedef struct {
@@ -140,7 +225,7 @@ static struct RootPropertyValues {
     dbus_bool_t fullscreen;
 } root_values = {.can_quit = TRUE,
                  .can_raise = FALSE,
-                 .has_track_list = FALSE,
+                 .has_track_list = TRUE,
                  .identity = APP_NAME,
                  .can_set_fullscreen = FALSE,
                  .fullscreen = FALSE};
@@ -170,10 +255,11 @@ struct PlayerPropertyValues {
     dbus_bool_t can_pause;
     dbus_bool_t can_seek;
     dbus_bool_t can_control;
+    int64_t position; // refreshed from the audio clock whenever it is asked for
 } player_values = {.playback_status = "Stopped",
                    .rate = 1.0,
                    .shuffle = 0,
-                   .loop_status = "None",
+                   .loop_status = loop_none,
                    .minimum_rate = 1.0,
                    .maximum_rate = 1.0,
                    .can_go_next = FALSE,
@@ -184,7 +270,7 @@ struct PlayerPropertyValues {
                    .can_control = TRUE};
 const char *playerprop_names[] = {"CanControl",     "CanGoNext",  "CanGoPrevious", "CanPause", "CanPlay",
                                   "CanSeek",        "LoopStatus", "MaximumRate",   "Metadata", "MinimumRate",
-                                  "PlaybackStatus", "Rate",       "Shuffle"};
+                                  "PlaybackStatus", "Position",   "Rate",          "Shuffle"};
 PropertyValue playerprop_values[] = {{DBUS_TYPE_BOOLEAN, &player_values.can_control},
                                      {DBUS_TYPE_BOOLEAN, &player_values.can_go_next},
                                      {DBUS_TYPE_BOOLEAN, &player_values.can_go_previous},
@@ -195,14 +281,126 @@ PropertyValue playerprop_values[] = {{DBUS_TYPE_BOOLEAN, &player_values.can_cont
                                      {DBUS_TYPE_DOUBLE, &player_values.maximum_rate},
                                      {DBUS_TYPE_DOUBLE, &player_values.minimum_rate},
                                      {DBUS_TYPE_STRING, &player_values.playback_status},
+                                     {DBUS_TYPE_INT64, &player_values.position},
                                      {DBUS_TYPE_DOUBLE, &player_values.rate},
                                      {DBUS_TYPE_BOOLEAN, &player_values.shuffle}};
 #define METADATA_INDEX 8
-char *uri = NULL;
-int64_t position = 0;
+
+// Daemon specific properties. Gaps are how long, in microseconds, the sink ran dry while reconnecting. Wakeups are
+// the voluntary context switches of the whole process per second, averaged over WAKEUP_REPORT_INTERVAL. A new
+// resampler profile applies from the next track on. Recording is the path of the running recording, empty if there is
+// none, and RecordingDropped counts the packets it lost to a slow disk. TimeshiftDelay is how far, in microseconds,
+// playback is behind a live stream and TimeshiftWindow how much of it is buffered. When streaming with -n, RtpReceivers
+// counts the receivers heard from lately, RtpSkew is the spread of their playback errors and RtpDelay how far ahead
+// of presentation packets are sent, both in microseconds. SampleFormat is what the sink is fed, always s16 over RTP,
+// and a new Dither mode applies to 16 bit sinks right away.
+struct TinyaudioPropertyValues {
+    dbus_bool_t burst_mode;
+    const char *dither;
+    dbus_uint32_t reconnect_count;
+    int64_t last_gap;
+    int64_t total_gap;
+    double wakeups_per_second;
+    const char *resampler;
+    const char *recording;
+    dbus_uint32_t recording_dropped;
+    dbus_bool_t timeshift;
+    int64_t timeshift_delay;
+    int64_t timeshift_window;
+    dbus_uint32_t rtp_receivers;
+    int64_t rtp_skew;
+    int64_t rtp_delay;
+    const char *sample_format;
+} tinyaudio_values = {.dither = "tpdf", .resampler = "default", .recording = "", .sample_format = "s16"};
+const char *tinyaudioprop_names[] = {"BurstMode",      "Dither",           "LastGap",      "ReconnectCount",
+                                     "Recording",      "RecordingDropped", "Resampler",    "RtpDelay",
+                                     "RtpReceivers",   "RtpSkew",          "SampleFormat", "Timeshift",
+                                     "TimeshiftDelay", "TimeshiftWindow",  "TotalGap",     "WakeupsPerSecond"};
+PropertyValue tinyaudioprop_values[] = {{DBUS_TYPE_BOOLEAN, &tinyaudio_values.burst_mode},
+                                        {DBUS_TYPE_STRING, &tinyaudio_values.dither},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.last_gap},
+                                        {DBUS_TYPE_UINT32, &tinyaudio_values.reconnect_count},
+                                        {DBUS_TYPE_STRING, &tinyaudio_values.recording},
+                                        {DBUS_TYPE_UINT32, &tinyaudio_values.recording_dropped},
+                                        {DBUS_TYPE_STRING, &tinyaudio_values.resampler},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.rtp_delay},
+                                        {DBUS_TYPE_UINT32, &tinyaudio_values.rtp_receivers},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.rtp_skew},
+                                        {DBUS_TYPE_STRING, &tinyaudio_values.sample_format},
+                                        {DBUS_TYPE_BOOLEAN, &tinyaudio_values.timeshift},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.timeshift_delay},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.timeshift_window},
+                                        {DBUS_TYPE_INT64, &tinyaudio_values.total_gap},
+                                        {DBUS_TYPE_DOUBLE, &tinyaudio_values.wakeups_per_second}};
+const char *equalizerprop_names[] = {"Bands", "Enabled", "Preamp"};
+
+dbus_bool_t can_edit_tracks = FALSE;
+tracklist_t tracklist;
+dbus_bool_t tracklist_replaced = FALSE;
+struct {
+    uint32_t track; // track index + 1, 0 when the slot is free
+    AVDictionary *tags;
+    int64_t duration;
+} metadata_cache[METADATA_CACHE_SIZE];
+library_t library;
+enum scan_state_t { SCAN_IDLE, SCAN_RUNNING, SCAN_DONE };
+atomic_int scan_state = SCAN_IDLE;
+enum resample_profile resample_profile = RESAMPLE_DEFAULT;
+const char *rtp_address; // stream to this host:port instead of playing locally
+enum output_format output_format = OUTPUT_S16;
+output_t output;
+int64_t decoded_ts = AV_NOPTS_VALUE; // end of the last decoded frame, AV_TIME_BASE units
+dbus_bool_t flush_pending = FALSE;
+dbus_bool_t seek_pending = FALSE; // Seeked is sent once the first frame after a seek is decoded
 ffmpegparams_t ffmpegparams;
+struct {
+    float *data;
+    int frames;   // a full burst
+    int capacity; // frames the buffer holds
+    int fill;
+    dbus_bool_t draining; // the tracklist ended, what is left goes out once it fits
+} burst;
+// NOTE: the audio clock tells what is audible right now: the end of the last decoded frame, less what the burst buffer
+// and the sink still hold. The sink is asked for its latency at most every CLOCK_SYNC_INTERVAL while audio is written
+// to it; in between, and for every client asking for Position, the clock runs on the monotonic clock at the playback
+// rate, and never past the decoded audio, which is where it stops when the sink runs dry. After a reset it stands still
+// until audio reaches the sink again.
+struct {
+    int64_t position; // AV_TIME_BASE units, stream timestamps, as of `at`
+    int64_t at;       // av_gettime_relative()
+    int64_t synced_at;
+    dbus_bool_t running;
+} audio_clock;
+timeshift_t timeshift;
+// With recording_split set a new file is started whenever the stream title changes.
+recording_t *recording;
+char *recording_path;
+char *recording_title;
+dbus_bool_t recording_split;
+// Unique bus names of the clients reading the tap. Nothing is written to the tap while there are none.
+tap_t tap;
+dsp_t dsp;
+struct {
+    char *names[TAP_MAX_CLIENTS];
+    int count;
+} tap_clients;
+reconnect_t reconnect;
+struct {
+    int64_t dropped_at; // av_gettime_relative() when the connection was lost
+    int64_t buffered;   // audio queued in the sink at that moment, usec
+    int64_t resume_ts;  // where to continue in a stream that is not live, AV_TIME_BASE units
+    dbus_bool_t gap_pending;
+} dropout;
 enum status_t { PLAYING, PAUSED, STOPPED, QUITTING };
 enum status_t status = STOPPED;
+// What was last saved of the playback state. The queue is only saved again once the tracklist changed.
+struct {
+    int64_t at;
+    enum status_t status;
+    uint32_t pos;
+    uint64_t queue_id;
+    dbus_bool_t queue_changed;
+} checkpoint = {.status = STOPPED};
 
 static inline void set_playing() {
     status = PLAYING;
@@ -219,6 +417,42 @@ static inline void set_stopped() {
     player_values.playback_status = STRING_STOPPED;
 }
 
+static inline int64_t burst_duration() { return av_rescale(burst.fill, AV_TIME_BASE, SAMPLE_RATE); }
+
+static inline int64_t clock_position() {
+    int64_t pos = audio_clock.position;
+    if (audio_clock.running) {
+        pos += (av_gettime_relative() - audio_clock.at) * player_values.rate;
+        if (pos > decoded_ts - burst_duration())
+            pos = decoded_ts - burst_duration();
+    }
+    return pos;
+}
+
+static inline void clock_reset(int64_t position) {
+    audio_clock.position = position;
+    audio_clock.at = av_gettime_relative();
+    audio_clock.running = FALSE;
+}
+
+// Restarts the clock from where it is now, for a change of rate.
+static inline void clock_rebase() {
+    int64_t pos = clock_position();
+    audio_clock.position = pos;
+    audio_clock.at = av_gettime_relative();
+}
+
+// Position as MPRIS has it: microseconds from the start of the track.
+static inline int64_t player_position(const ffmpegparams_t *ffmpegparams) {
+    if (decoded_ts == AV_NOPTS_VALUE)
+        return 0;
+    int64_t start = 0;
+    if (ffmpegparams->fmt && ffmpegparams->fmt->start_time != AV_NOPTS_VALUE)
+        start = ffmpegparams->fmt->start_time;
+    int64_t pos = clock_position() - start;
+    return pos < 0 ? 0 : pos;
+}
+
 int binsearch(const char *target, const char *array[], int nelements) {
     int first = 0;
     int last = nelements - 1;
@@ -254,57 +488,126 @@ const char *tag2xesam(const char *tagname) {
     return NULL;
 }
 
-typedef pa_simple audio_t;
-audio_t *initaudio() {
+double cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The sink is either the sound server or, when streaming to other rooms, the network.
+typedef struct {
+    pa_simple *pulse;
+    rtp_sender_t *rtp;
+} audio_t;
+
+// RTP always carries 16 bit, the sound server takes format.
+audio_t *initaudio(dbus_bool_t burst_mode, const char *rtp_address, enum output_format format) {
+    audio_t *audio = calloc(1, sizeof(audio_t));
+    if (!audio)
+        return NULL;
+    if (rtp_address) {
+        audio->rtp = rtp_sender_open(rtp_address);
+        if (!audio->rtp) {
+            free(audio);
+            return NULL;
+        }
+        return audio;
+    }
+
     pa_simple *s;
     pa_sample_spec ss;
 
-    ss.format = PA_SAMPLE_S16NE;
+    static const pa_sample_format_t pa_formats[OUTPUT_FORMATS] = {PA_SAMPLE_FLOAT32NE, PA_SAMPLE_S16NE, PA_SAMPLE_S24NE,
+                                                                  PA_SAMPLE_S32NE};
+    ss.format = pa_formats[format];
     ss.channels = 2;
     ss.rate = 44100;
 
+    // A whole burst plus the low watermark must fit in the sink, and the server is only asked to request more data
+    // once a whole burst fits again. Playback starts as soon as anything is written, not once the sink is full.
+    pa_buffer_attr attr;
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = pa_usec_to_bytes(BURST_SINK_LENGTH, &ss);
+    attr.prebuf = pa_usec_to_bytes(BURST_PREBUF, &ss);
+    attr.minreq = pa_usec_to_bytes(BURST_SECONDS * 1000000LL, &ss);
+    attr.fragsize = (uint32_t)-1;
+
     s = pa_simple_new(NULL,
                       APP_NAME, // Our application's name.
                       PA_STREAM_PLAYBACK,
-                      NULL,    // Use the default device.
-                      "Music", // Description of our stream.
-                      &ss,     // Our sample format.
-                      NULL,    // Use default channel map
-                      NULL,    // Use default buffering attributes.
-                      NULL     // Ignore error code.
+                      NULL,                      // Use the default device.
+                      "Music",                   // Description of our stream.
+                      &ss,                       // Our sample format.
+                      NULL,                      // Use default channel map
+                      burst_mode ? &attr : NULL, // Use default buffering attributes unless bursting.
+                      NULL                       // Ignore error code.
     );
-    return s;
+    if (!s) {
+        free(audio);
+        return NULL;
+    }
+    audio->pulse = s;
+    return audio;
 }
 
-void writeaudio(audio_t *audio, const uint8_t *outbuf, int frames) {
+// Converts frames of float audio to the sink format, in place, and queues them in the sink.
+void writeaudio(audio_t *audio, float *pcm, int frames) {
     int error;
-    int bytes = 2 * 2 * frames; // sizeof frame (16bits = 2bytes) * number of
-                                // channels (2) * frames
-    pa_simple_write(audio, outbuf, bytes, &error);
+    size_t bytes = output_convert(&output, pcm, frames);
+    if (audio->rtp)
+        rtp_send(audio->rtp, (const int16_t *)pcm, frames);
+    else
+        pa_simple_write(audio->pulse, pcm, bytes, &error);
 }
 
-void finishaudio(audio_t *audio) { pa_simple_free(audio); }
+void flushaudio(audio_t *audio) {
+    int error;
+    if (audio->rtp)
+        rtp_flush(audio->rtp);
+    else
+        pa_simple_flush(audio->pulse, &error);
+}
 
-int openuri(const char *uri, ffmpegparams_t *ffmpegparams) {
-    AVFormatContext *fmt = NULL;
-    if (avformat_open_input(&fmt, uri, NULL, NULL) < 0) {
-        syslog(LOG_ERR, "Failed to open URI\n");
-        return 1;
-    }
-    if (avformat_find_stream_info(fmt, NULL) < 0) {
-        syslog(LOG_ERR, "Failed to read stream info\n");
-        return 1;
-    }
+void finishaudio(audio_t *audio) {
+    if (audio->rtp)
+        rtp_sender_close(audio->rtp);
+    else
+        pa_simple_free(audio->pulse);
+    free(audio);
+}
 
+// Returns how much audio, in microseconds, is queued in the sink and not yet played.
+int64_t latencyaudio(audio_t *audio) {
+    int error;
+    if (audio->rtp)
+        return rtp_latency(audio->rtp);
+    pa_usec_t latency = pa_simple_get_latency(audio->pulse, &error);
+    return latency == (pa_usec_t)-1 ? 0 : (int64_t)latency;
+}
+
+// Called after writing to the sink, which is the only time its latency changes other than by playing.
+void clock_sync(audio_t *audio) {
+    int64_t now = av_gettime_relative();
+    if (decoded_ts == AV_NOPTS_VALUE || (audio_clock.running && now - audio_clock.synced_at < CLOCK_SYNC_INTERVAL))
+        return;
+    audio_clock.position = decoded_ts - latencyaudio(audio) - burst_duration();
+    audio_clock.at = audio_clock.synced_at = av_gettime_relative();
+    audio_clock.running = TRUE;
+}
+
+// Sets up decoding of the best audio stream of an opened input. Takes ownership of fmt, also on failure.
+int open_decoder(AVFormatContext *fmt, ffmpegparams_t *ffmpegparams) {
     const AVCodec *codec = NULL;
     int astream = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
     if (astream < 0) {
         syslog(LOG_ERR, "No audio stream present\n");
+        avformat_close_input(&fmt);
         return 1;
     }
 
     if (!codec) {
         syslog(LOG_ERR, "No decoder\n");
+        avformat_close_input(&fmt);
         return 1;
     }
 
@@ -313,16 +616,18 @@ int openuri(const char *uri, ffmpegparams_t *ffmpegparams) {
     cc->pkt_timebase = fmt->streams[astream]->time_base;
     if (avcodec_open2(cc, codec, NULL) < 0) {
         syslog(LOG_ERR, "Failed to open decoder\n");
+        avcodec_free_context(&cc);
+        avformat_close_input(&fmt);
         return 1;
     }
 
-    AVChannelLayout out_layout, in_layout;
-    av_channel_layout_default(&out_layout, CHANNELS);
-    av_channel_layout_default(&in_layout, cc->ch_layout.nb_channels);
-    SwrContext *swr = swr_alloc();
-    swr_alloc_set_opts2(&swr, &out_layout, AV_SAMPLE_FMT_S16, SAMPLE_RATE, &in_layout, cc->sample_fmt, cc->sample_rate,
-                        0, NULL);
-    swr_init(swr);
+    SwrContext *swr =
+        resample_get(resample_profile, AV_SAMPLE_FMT_FLT, cc->ch_layout.nb_channels, cc->sample_fmt, cc->sample_rate);
+    if (!swr) {
+        avcodec_free_context(&cc);
+        avformat_close_input(&fmt);
+        return 1;
+    }
     ffmpegparams->fmt = fmt;
     ffmpegparams->astream = astream;
     ffmpegparams->cc = cc;
@@ -331,10 +636,326 @@ int openuri(const char *uri, ffmpegparams_t *ffmpegparams) {
     return 0;
 }
 
+static inline AVDictionary *stream_metadata(const ffmpegparams_t *ffmpegparams) {
+    if (ffmpegparams->metadata || timeshift_attached(&timeshift))
+        return ffmpegparams->metadata;
+    return ffmpegparams->fmt ? ffmpegparams->fmt->metadata : NULL;
+}
+
+// Opens an input and its decoder. The input is probed for its stream parameters, unless the saved state has them and
+// the input still matches them, which saves reading up to several seconds of a remote stream before playing it.
+static int open_input(const char *uri, const state_t *saved, ffmpegparams_t *ffmpegparams) {
+    AVFormatContext *fmt = avformat_alloc_context();
+    if (!fmt)
+        return 1;
+    fmt->interrupt_callback.callback = timeshift_interrupted;
+    fmt->interrupt_callback.opaque = &timeshift;
+    const AVInputFormat *iformat = saved ? av_find_input_format(saved->header.format) : NULL;
+    if (avformat_open_input(&fmt, uri, iformat, NULL) < 0) {
+        syslog(LOG_ERR, "Failed to open URI\n");
+        return 1;
+    }
+    if (saved && !state_apply(saved, fmt))
+        return open_decoder(fmt, ffmpegparams);
+    if (avformat_find_stream_info(fmt, NULL) < 0) {
+        syslog(LOG_ERR, "Failed to read stream info\n");
+        avformat_close_input(&fmt);
+        return 1;
+    }
+    return open_decoder(fmt, ffmpegparams);
+}
+
+int openuri(const char *uri, ffmpegparams_t *ffmpegparams) { return open_input(uri, NULL, ffmpegparams); }
+
+void stop_recording() {
+    if (!recording)
+        return;
+    recorder_stop(recording);
+    recording = NULL;
+    free(recording_path);
+    recording_path = NULL;
+    free(recording_title);
+    recording_title = NULL;
+    tinyaudio_values.recording = "";
+}
+
+// Starts a new recording file when the ICY stream title changes, which on most stations is a new show or song.
+void split_recording(const AVDictionary *metadata) {
+    const AVDictionaryEntry *tag = av_dict_get(metadata, "StreamTitle", NULL, 0);
+    if (!tag || (recording_title && strcmp(recording_title, tag->value) == 0))
+        return;
+    if (recording_title)
+        recorder_split(recording);
+    free(recording_title);
+    recording_title = strdup(tag->value);
+}
+
 void ffmpegparams_free(ffmpegparams_t *ffmpegparams) {
+    stop_recording();
+    timeshift_clear(&timeshift);
+    player_values.can_seek = FALSE;
+    av_dict_free(&ffmpegparams->metadata);
+    reconnect_cancel(&reconnect);
+    dropout.gap_pending = FALSE;
+    decoded_ts = AV_NOPTS_VALUE;
+    clock_reset(0);
     avcodec_free_context(&ffmpegparams->cc);
     avformat_close_input(&ffmpegparams->fmt);
-    swr_free(&ffmpegparams->swr);
+    ffmpegparams->swr = NULL; // owned by the resampler cache
+}
+
+static inline int is_local(const char *uri) { return !strstr(uri, "://") || strncmp(uri, "file:", 5) == 0; }
+
+static inline dbus_bool_t wrap_tracklist() { return player_values.loop_status == loop_playlist; }
+
+static inline void update_navigation() {
+    player_values.can_go_next = tracklist.pos + 1 < tracklist.len || (wrap_tracklist() && tracklist.len > 0);
+    player_values.can_go_previous = tracklist.pos > 0 || (wrap_tracklist() && tracklist.len > 0);
+}
+
+// Opens the current track of the tracklist. Tracks that fail to open are skipped, so this only fails when there is
+// nothing playable left before the end of the list.
+int open_current(ffmpegparams_t *ffmpegparams) {
+    char location[4096];
+    uint32_t track = tracklist_current(&tracklist);
+    for (uint32_t tries = 0; track != TRACK_NONE && tries < tracklist.len; tries++) {
+        if (tracklist_resolve(&tracklist, track, location, sizeof(location)) == 0 && !openuri(location, ffmpegparams))
+            break;
+        ffmpegparams_free(ffmpegparams);
+        track = tracklist_next(&tracklist, FALSE);
+    }
+    update_navigation();
+    return track == TRACK_NONE || ffmpegparams->fmt == NULL;
+}
+
+static void metadata_cache_clear() {
+    for (int i = 0; i < METADATA_CACHE_SIZE; i++) {
+        av_dict_free(&metadata_cache[i].tags);
+        metadata_cache[i].track = 0;
+    }
+}
+
+// Replaces the tracklist with the entries of a playlist, or with a single entry for anything else, HLS included.
+int load_uri(const char *uri, ffmpegparams_t *ffmpegparams) {
+    metadata_cache_clear();
+    int loaded = is_playlist(uri) ? tracklist_load(&tracklist, uri) : PLAYLIST_STREAM;
+    if (loaded != PLAYLIST_STREAM) {
+        if (loaded)
+            return 1;
+    } else {
+        tracklist_reset(&tracklist);
+        if (tracklist_add(&tracklist, uri, NULL, -1))
+            return 1;
+    }
+    tracklist_set_shuffle(&tracklist, player_values.shuffle);
+    tracklist_replaced = TRUE;
+    checkpoint.queue_changed = TRUE;
+    return open_current(ffmpegparams);
+}
+
+// Saves what is playing, and where, so that `tinyaudio play` can pick up from there after the player quit or died.
+void save_state(const ffmpegparams_t *ffmpegparams) {
+    char location[4096];
+    if (tracklist_resolve(&tracklist, tracklist_current(&tracklist), location, sizeof(location)))
+        return;
+    if (checkpoint.queue_changed) {
+        checkpoint.queue_id = av_gettime();
+        if (queue_save(state_path(QUEUE_FILE), &tracklist, checkpoint.queue_id))
+            checkpoint.queue_id = 0;
+        checkpoint.queue_changed = FALSE;
+    }
+    state_t state = {.location = location};
+    state.header.pos = tracklist.pos;
+    state.header.queue_id = checkpoint.queue_id;
+    state.header.shuffle = player_values.shuffle;
+    for (uint32_t i = 0; i < sizeof(loop_statuses) / sizeof(loop_statuses[0]); i++) {
+        if (loop_statuses[i] == player_values.loop_status)
+            state.header.loop = i;
+    }
+    if (ffmpegparams->fmt) {
+        // Until the first frame is decoded the clock stands where the track was opened, or restored, at.
+        int64_t start = ffmpegparams->fmt->start_time != AV_NOPTS_VALUE ? ffmpegparams->fmt->start_time : 0;
+        int64_t position = decoded_ts == AV_NOPTS_VALUE ? audio_clock.position - start : player_position(ffmpegparams);
+        state.header.position = position > 0 ? position : 0;
+        state_describe(&state, ffmpegparams->fmt, ffmpegparams->astream);
+    }
+    state_save(state_path(STATE_FILE), &state);
+    checkpoint.at = av_gettime_relative();
+    checkpoint.status = status;
+    checkpoint.pos = tracklist.pos;
+}
+
+static inline dbus_bool_t checkpoint_due() {
+    if (checkpoint.queue_changed || status != checkpoint.status || tracklist.pos != checkpoint.pos)
+        return TRUE;
+    return status == PLAYING && av_gettime_relative() - checkpoint.at >= CHECKPOINT_INTERVAL;
+}
+
+// Rebuilds the tracklist from the saved state and opens the track that was playing at the saved position. Files are
+// reopened with a direct seek, live streams from wherever they are now.
+int restore_state(const state_t *state, ffmpegparams_t *ffmpegparams) {
+    uint32_t loop = state->header.loop;
+    player_values.loop_status = loop_statuses[loop < sizeof(loop_statuses) / sizeof(loop_statuses[0]) ? loop : 0];
+    player_values.shuffle = state->header.shuffle != 0;
+    checkpoint.queue_id = state->header.queue_id;
+    if (queue_load(state_path(QUEUE_FILE), &tracklist, state->header.queue_id, state->header.pos)) {
+        tracklist_reset(&tracklist);
+        if (tracklist_add(&tracklist, state->location, NULL, -1))
+            return 1;
+        tracklist_set_shuffle(&tracklist, player_values.shuffle);
+        checkpoint.queue_changed = TRUE;
+    }
+    tracklist_replaced = TRUE;
+    checkpoint.pos = tracklist.pos;
+
+    char location[4096];
+    if (tracklist_resolve(&tracklist, tracklist_current(&tracklist), location, sizeof(location)) ||
+        strcmp(location, state->location) != 0)
+        return open_current(ffmpegparams);
+    const state_t *saved = state_usable(state, location) ? NULL : state;
+    if (open_input(location, saved, ffmpegparams) && (!saved || openuri(location, ffmpegparams)))
+        return open_current(ffmpegparams);
+    update_navigation();
+    AVFormatContext *fmt = ffmpegparams->fmt;
+    if (state->header.position > 0 && fmt->duration != AV_NOPTS_VALUE) {
+        int64_t target = state->header.position + (fmt->start_time != AV_NOPTS_VALUE ? fmt->start_time : 0);
+        if (av_seek_frame(fmt, -1, target, AVSEEK_FLAG_BACKWARD) >= 0)
+            clock_reset(target);
+    }
+    return 0;
+}
+
+// Switches to whatever track the tracklist now points at. A stopped player only moves its cursor, a paused one
+// stays paused on the new track.
+static inline void change_track(ffmpegparams_t *ffmpegparams) {
+    flush_pending = TRUE;
+    update_navigation();
+    if (status == STOPPED)
+        return;
+    ffmpegparams_free(ffmpegparams);
+    if (open_current(ffmpegparams))
+        set_stopped();
+}
+
+// Decides whether a failed read should be answered by reconnecting. End of file is only a dropped connection for
+// remote streams without a duration, i.e. live ones.
+static inline int is_reconnectable(const ffmpegparams_t *ffmpegparams, int read_result) {
+    if (is_local(ffmpegparams->fmt->url))
+        return 0;
+    return read_result != AVERROR_EOF || ffmpegparams->fmt->duration == AV_NOPTS_VALUE;
+}
+
+int start_reconnect(audio_t *audio, ffmpegparams_t *ffmpegparams, int64_t last_dts) {
+    dropout.dropped_at = av_gettime_relative();
+    dropout.buffered = latencyaudio(audio);
+    dropout.resume_ts = AV_NOPTS_VALUE;
+    if (ffmpegparams->fmt->duration != AV_NOPTS_VALUE && last_dts != AV_NOPTS_VALUE)
+        dropout.resume_ts =
+            av_rescale_q(last_dts, ffmpegparams->fmt->streams[ffmpegparams->astream]->time_base, AV_TIME_BASE_Q);
+    syslog(LOG_WARNING, "Connection lost with %lld ms of audio buffered, reconnecting\n",
+           (long long)dropout.buffered / 1000);
+    AVIOInterruptCB interrupt = {timeshift_interrupted, &timeshift};
+    return reconnect_start(&reconnect, ffmpegparams->fmt->url, &interrupt);
+}
+
+// Continues playback from a freshly reconnected input. When the stream still carries the same codec the decoder and
+// resampler are kept, nothing is restarted and the stream is not probed again.
+int splice_input(ffmpegparams_t *ffmpegparams, AVFormatContext *fmt) {
+    timeshift_detach(&timeshift);
+    int astream = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    const AVCodecParameters *par = astream >= 0 ? fmt->streams[astream]->codecpar : NULL;
+    const AVCodecContext *cc = ffmpegparams->cc;
+    if (dropout.resume_ts != AV_NOPTS_VALUE)
+        av_seek_frame(fmt, -1, dropout.resume_ts, AVSEEK_FLAG_BACKWARD);
+    if (par && par->codec_id == cc->codec_id && (!par->sample_rate || par->sample_rate == cc->sample_rate) &&
+        (!par->ch_layout.nb_channels || par->ch_layout.nb_channels == cc->ch_layout.nb_channels)) {
+        avformat_close_input(&ffmpegparams->fmt);
+        ffmpegparams->fmt = fmt;
+        ffmpegparams->astream = astream;
+        ffmpegparams->cc->pkt_timebase = fmt->streams[astream]->time_base;
+        avcodec_flush_buffers(ffmpegparams->cc);
+        dropout.gap_pending = TRUE;
+        return 0;
+    }
+
+    syslog(LOG_INFO, "Stream parameters changed on reconnect\n");
+    if (avformat_find_stream_info(fmt, NULL) < 0) {
+        syslog(LOG_ERR, "Failed to read stream info\n");
+        avformat_close_input(&fmt);
+        return 1;
+    }
+    ffmpegparams_free(ffmpegparams);
+    if (open_decoder(fmt, ffmpegparams))
+        return 1;
+    dropout.gap_pending = TRUE;
+    return 0;
+}
+
+// Called for the first audio written after a reconnect: whatever part of the outage was not covered by the audio that
+// was already buffered is the gap listeners heard.
+static inline void record_gap() {
+    int64_t gap = av_gettime_relative() - dropout.dropped_at - dropout.buffered;
+    if (gap < 0)
+        gap = 0;
+    tinyaudio_values.reconnect_count++;
+    tinyaudio_values.last_gap = gap;
+    tinyaudio_values.total_gap += gap;
+    dropout.gap_pending = FALSE;
+    syslog(LOG_NOTICE, "Reconnected after %d attempts, %lld ms gap (%u reconnects so far)\n", reconnect.attempts,
+           (long long)gap / 1000, tinyaudio_values.reconnect_count);
+}
+
+static inline const char *track_path(uint32_t track, char *buf, size_t size) {
+    if (track == TRACK_NONE)
+        return OBJ_PATH NO_TRACK;
+    snprintf(buf, size, OBJ_PATH TRACK_PREFIX "%u", track);
+    return buf;
+}
+
+static inline uint32_t path_track(const char *path) {
+    const char *prefix = OBJ_PATH TRACK_PREFIX;
+    if (strncmp(path, prefix, strlen(prefix)) != 0)
+        return TRACK_NONE;
+    char *end;
+    unsigned long track = strtoul(path + strlen(prefix), &end, 10);
+    if (*end || track >= tracklist.len)
+        return TRACK_NONE;
+    return track;
+}
+
+// Reads the tags of a track that is not playing. Only local files are probed and only their headers are read;
+// opening remote streams just to show a title is too expensive.
+static AVDictionary *probe_metadata(uint32_t track, int64_t *duration, int *budget) {
+    int slot = track % METADATA_CACHE_SIZE;
+    if (metadata_cache[slot].track == track + 1) {
+        *duration = metadata_cache[slot].duration;
+        return metadata_cache[slot].tags;
+    }
+    if (*budget <= 0)
+        return NULL;
+    (*budget)--;
+
+    char location[4096];
+    if (tracklist_resolve(&tracklist, track, location, sizeof(location)) || !is_local(location))
+        return NULL;
+
+    AVFormatContext *fmt = NULL;
+    if (avformat_open_input(&fmt, location, NULL, NULL) < 0)
+        return NULL;
+    AVDictionary *tags = NULL;
+    av_dict_copy(&tags, fmt->metadata, 0);
+    for (unsigned int i = 0; i < fmt->nb_streams; i++) {
+        if (fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+            av_dict_copy(&tags, fmt->streams[i]->metadata, AV_DICT_DONT_OVERWRITE);
+    }
+    *duration = fmt->duration != AV_NOPTS_VALUE ? fmt->duration : -1;
+    avformat_close_input(&fmt);
+
+    av_dict_free(&metadata_cache[slot].tags);
+    metadata_cache[slot].track = track + 1;
+    metadata_cache[slot].tags = tags;
+    metadata_cache[slot].duration = *duration;
+    return tags;
 }
 
 void add_basic_variant(DBusMessageIter *iter, int type, const void *value) {
@@ -357,11 +978,27 @@ void add_dict_entry(DBusMessageIter *iter, const char *key, int type, const void
     dbus_message_iter_close_container(iter, &sub);
 }
 
-static inline void add_metadata_entries(DBusMessageIter *iter, AVDictionary *metadata) {
-    const char *path = OBJ_PATH NO_TRACK;
+static inline void add_metadata_entries(DBusMessageIter *iter, uint32_t track, AVDictionary *metadata,
+                                        int64_t duration) {
+    char buf[64];
+    const char *path = track_path(track, buf, sizeof(buf));
 
     add_dict_entry(iter, "mpris:trackId", DBUS_TYPE_OBJECT_PATH, &path);
 
+    if (track != TRACK_NONE) {
+        char location[4096];
+        const char *url = location;
+        if (tracklist_resolve(&tracklist, track, location, sizeof(location)) == 0 && dbus_validate_utf8(url, NULL))
+            add_dict_entry(iter, "xesam:url", DBUS_TYPE_STRING, &url);
+        const char *title = tracklist_string(&tracklist, tracklist.tracks[track].title);
+        if (*title && !av_dict_get(metadata, "title", NULL, 0) && dbus_validate_utf8(title, NULL))
+            add_dict_entry(iter, "xesam:title", DBUS_TYPE_STRING, &title);
+        if (duration < 0 && tracklist.tracks[track].duration > 0)
+            duration = (int64_t)tracklist.tracks[track].duration * 1000000;
+    }
+    if (duration >= 0)
+        add_dict_entry(iter, "mpris:length", DBUS_TYPE_INT64, &duration);
+
     const AVDictionaryEntry *tag = NULL;
     while ((tag = av_dict_iterate(metadata, tag))) {
         const char *key = NULL;
@@ -405,27 +1042,44 @@ void add_mimetypes(DBusMessageIter *iter) {
     }
 }
 
-void add_metadata_variant(DBusMessageIter *iter, AVDictionary *metadata) {
+static inline int64_t current_duration(const ffmpegparams_t *ffmpegparams) {
+    if (!ffmpegparams->fmt || ffmpegparams->fmt->duration == AV_NOPTS_VALUE)
+        return -1;
+    return ffmpegparams->fmt->duration;
+}
+
+void add_metadata_variant(DBusMessageIter *iter, const ffmpegparams_t *ffmpegparams) {
     DBusMessageIter sub, map;
     dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}", &sub);
     dbus_message_iter_open_container(&sub, DBUS_TYPE_ARRAY, "{sv}", &map);
 
-    add_metadata_entries(&map, metadata);
+    add_metadata_entries(&map, tracklist_current(&tracklist), stream_metadata(ffmpegparams),
+                         current_duration(ffmpegparams));
 
     dbus_message_iter_close_container(&sub, &map);
     dbus_message_iter_close_container(iter, &sub);
 }
 
-void add_metadata_dict_entry(DBusMessageIter *iter, AVDictionary *metadata) {
+void add_metadata_dict_entry(DBusMessageIter *iter, const ffmpegparams_t *ffmpegparams) {
     DBusMessageIter entry;
     dbus_message_iter_open_container(iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
     const char *val = "Metadata";
     dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &val);
-    add_metadata_variant(&entry, metadata);
+    add_metadata_variant(&entry, ffmpegparams);
     dbus_message_iter_close_container(iter, &entry);
 }
 
-void notify_metadata_changed(DBusConnection *connection, AVDictionary *metadata) {
+// Appends the ids of the tracks around the current one, in play order.
+void add_tracks(DBusMessageIter *iter) {
+    uint32_t first = tracklist.pos > TRACKLIST_PAGE_SIZE / 4 ? tracklist.pos - TRACKLIST_PAGE_SIZE / 4 : 0;
+    for (uint32_t pos = first; pos < tracklist.len && pos < first + TRACKLIST_PAGE_SIZE; pos++) {
+        char buf[64];
+        const char *path = track_path(tracklist_at(&tracklist, pos), buf, sizeof(buf));
+        dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+    }
+}
+
+void notify_metadata_changed(DBusConnection *connection, const ffmpegparams_t *ffmpegparams) {
     DBusMessageIter iter, sub;
     DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
     dbus_message_iter_init_append(signal, &iter);
@@ -434,7 +1088,7 @@ void notify_metadata_changed(DBusConnection *connection, AVDictionary *metadata)
 
     DBusMessageIter array;
     assert(dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &array));
-    add_metadata_dict_entry(&array, metadata);
+    add_metadata_dict_entry(&array, ffmpegparams);
     dbus_message_iter_close_container(&iter, &array);
 
     dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &sub);
@@ -443,16 +1097,16 @@ void notify_metadata_changed(DBusConnection *connection, AVDictionary *metadata)
     dbus_message_unref(signal);
 }
 
-void notify_playback_status_changed(DBusConnection *connection, const char *new_status) {
+void notify_property_changed(DBusConnection *connection, const char *interface, const char *name, int type,
+                             const void *value) {
     DBusMessageIter iter, sub;
     DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
     dbus_message_iter_init_append(signal, &iter);
-    const char *interface = IFACE_PLAYER;
     dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface);
 
     DBusMessageIter array;
     assert(dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &array));
-    add_dict_entry(&array, "PlaybackStatus", DBUS_TYPE_STRING, &new_status);
+    add_dict_entry(&array, name, type, value);
     dbus_message_iter_close_container(&iter, &array);
 
     dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &sub);
@@ -461,6 +1115,50 @@ void notify_playback_status_changed(DBusConnection *connection, const char *new_
     dbus_message_unref(signal);
 }
 
+void notify_playback_status_changed(DBusConnection *connection, const char *new_status) {
+    notify_property_changed(connection, IFACE_PLAYER, "PlaybackStatus", DBUS_TYPE_STRING, &new_status);
+}
+
+void notify_seeked(DBusConnection *connection, int64_t position) {
+    DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, IFACE_PLAYER, "Seeked");
+    dbus_message_append_args(signal, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID);
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+}
+
+void notify_tracklist_replaced(DBusConnection *connection) {
+    DBusMessageIter iter, array;
+    DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, IFACE_TRACKLIST, "TrackListReplaced");
+    dbus_message_iter_init_append(signal, &iter);
+    assert(dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "o", &array));
+    add_tracks(&array);
+    dbus_message_iter_close_container(&iter, &array);
+
+    char buf[64];
+    const char *current = track_path(tracklist_current(&tracklist), buf, sizeof(buf));
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH, &current);
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+}
+
+// Announces a new current track, or a new tracklist, to clients. Called once per main loop iteration, so any number
+// of track changes in between results in one set of signals.
+void notify_track_changes(DBusConnection *connection, const ffmpegparams_t *ffmpegparams) {
+    static uint32_t announced_track = TRACK_NONE;
+    uint32_t track = tracklist_current(&tracklist);
+    if (tracklist_replaced) {
+        notify_tracklist_replaced(connection);
+        tracklist_replaced = FALSE;
+    } else if (track == announced_track) {
+        return;
+    }
+    announced_track = track;
+    notify_metadata_changed(connection, ffmpegparams);
+    notify_property_changed(connection, IFACE_PLAYER, "CanGoNext", DBUS_TYPE_BOOLEAN, &player_values.can_go_next);
+    notify_property_changed(connection, IFACE_PLAYER, "CanGoPrevious", DBUS_TYPE_BOOLEAN,
+                            &player_values.can_go_previous);
+}
+
 static inline dbus_bool_t get_relevant_args(DBusMessage *msg, const char **interface, const char **property) {
     DBusMessageIter iter;
     dbus_message_iter_init(msg, &iter);
@@ -487,20 +1185,86 @@ static inline DBusMessage *openuri_handler(DBusMessage *msg, ffmpegparams_t *ffm
     if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&args))
         return dbus_message_new_error(msg, "Argument is not string!\n", "");
 
+    const char *uri;
     dbus_message_iter_get_basic(&args, &uri);
-    if (!openuri(uri, ffmpegparams))
+    flush_pending = TRUE;
+    ffmpegparams_free(ffmpegparams);
+    if (!load_uri(uri, ffmpegparams))
         set_playing();
+    else
+        set_stopped();
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *next_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    if (tracklist_next(&tracklist, wrap_tracklist()) != TRACK_NONE)
+        change_track(ffmpegparams);
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *previous_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    if (tracklist_previous(&tracklist, wrap_tracklist()) != TRACK_NONE)
+        change_track(ffmpegparams);
+    return dbus_message_new_method_return(msg);
+}
+
+// A timeshifted stream keeps being received while paused.
+static inline void pause_input(ffmpegparams_t *ffmpegparams) {
+    if (!timeshift_attached(&timeshift))
+        av_read_pause(ffmpegparams->fmt);
+}
+
+static inline void resume_input(ffmpegparams_t *ffmpegparams) {
+    if (!timeshift_attached(&timeshift))
+        av_read_play(ffmpegparams->fmt);
+}
+
+// Moves within the timeshift window. Only a timeshifted stream can seek.
+static inline void seek_timeshift(ffmpegparams_t *ffmpegparams, int64_t offset) {
+    AVDictionary *metadata = NULL;
+    // The buffer seeks from what is read next, which is ahead of what is heard by whatever sits in the sink.
+    int64_t heard = clock_position();
+    if (decoded_ts != AV_NOPTS_VALUE)
+        timeshift_seek(&timeshift, offset - (decoded_ts - heard), &metadata);
+    else
+        timeshift_seek(&timeshift, offset, &metadata);
+    clock_reset(heard + offset);
+    if (metadata) {
+        av_dict_free(&ffmpegparams->metadata);
+        ffmpegparams->metadata = metadata;
+    }
+    avcodec_flush_buffers(ffmpegparams->cc);
+    flush_pending = TRUE;
+    seek_pending = TRUE;
+}
+
+static inline DBusMessage *seek_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    int64_t offset;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &offset, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected an offset");
+    if (timeshift_attached(&timeshift))
+        seek_timeshift(ffmpegparams, offset);
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *setposition_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    const char *path;
+    int64_t target;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INT64, &target, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a track id and a position");
+    if (timeshift_attached(&timeshift) && path_track(path) == tracklist_current(&tracklist))
+        seek_timeshift(ffmpegparams, target - player_position(ffmpegparams));
     return dbus_message_new_method_return(msg);
 }
 
 static inline DBusMessage *play_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     switch (status) {
         case PAUSED:
-            av_read_play(ffmpegparams->fmt);
+            resume_input(ffmpegparams);
             set_playing();
             break;
         case STOPPED:
-            if (uri != NULL && !openuri(uri, ffmpegparams))
+            if (tracklist.len > 0 && !open_current(ffmpegparams))
                 set_playing();
             break;
         default:
@@ -512,15 +1276,15 @@ static inline DBusMessage *play_handler(DBusMessage *msg, ffmpegparams_t *ffmpeg
 static inline DBusMessage *playpause_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     switch (status) {
         case PLAYING:
-            av_read_pause(ffmpegparams->fmt);
+            pause_input(ffmpegparams);
             set_paused();
             break;
         case PAUSED:
-            av_read_play(ffmpegparams->fmt);
+            resume_input(ffmpegparams);
             set_playing();
             break;
         case STOPPED:
-            if (uri != NULL && !openuri(uri, ffmpegparams))
+            if (tracklist.len > 0 && !open_current(ffmpegparams))
                 set_playing();
             break;
         default:
@@ -531,7 +1295,7 @@ static inline DBusMessage *playpause_handler(DBusMessage *msg, ffmpegparams_t *f
 
 static inline DBusMessage *pause_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     if (status == PLAYING) {
-        av_read_pause(ffmpegparams->fmt);
+        pause_input(ffmpegparams);
         set_paused();
     }
     return dbus_message_new_method_return(msg);
@@ -539,13 +1303,63 @@ static inline DBusMessage *pause_handler(DBusMessage *msg, ffmpegparams_t *ffmpe
 
 static inline DBusMessage *stop_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     if (status != STOPPED) {
-        avcodec_free_context(&ffmpegparams->cc);
-        avformat_close_input(&ffmpegparams->fmt);
+        flush_pending = TRUE;
+        ffmpegparams_free(ffmpegparams);
         set_stopped();
     }
     return dbus_message_new_method_return(msg);
 }
 
+// Bands are reported as (type, frequency in Hz, gain in dB, Q), in the order they are applied.
+static inline dbus_bool_t add_equalizer_variant(DBusMessageIter *iter, const char *property) {
+    if (strcmp(property, "Enabled") == 0) {
+        dbus_bool_t enabled = dsp.enabled;
+        add_basic_variant(iter, DBUS_TYPE_BOOLEAN, &enabled);
+    } else if (strcmp(property, "Preamp") == 0) {
+        add_basic_variant(iter, DBUS_TYPE_DOUBLE, &dsp.preamp);
+    } else if (strcmp(property, "Bands") == 0) {
+        DBusMessageIter variant, array, band;
+        dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a(sddd)", &variant);
+        dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "(sddd)", &array);
+        for (int i = 0; i < dsp.nbands; i++) {
+            const eq_band_t *b = &dsp.bands[i];
+            dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &band);
+            dbus_message_iter_append_basic(&band, DBUS_TYPE_STRING, &eq_type_names[b->type]);
+            dbus_message_iter_append_basic(&band, DBUS_TYPE_DOUBLE, &b->frequency);
+            dbus_message_iter_append_basic(&band, DBUS_TYPE_DOUBLE, &b->gain);
+            dbus_message_iter_append_basic(&band, DBUS_TYPE_DOUBLE, &b->q);
+            dbus_message_iter_close_container(&array, &band);
+        }
+        dbus_message_iter_close_container(&variant, &array);
+        dbus_message_iter_close_container(iter, &variant);
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void notify_bands_changed(DBusConnection *connection) {
+    DBusMessageIter iter, sub;
+    DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
+    dbus_message_iter_init_append(signal, &iter);
+    const char *interface = IFACE_EQUALIZER;
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface);
+
+    DBusMessageIter array, entry;
+    assert(dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &array));
+    dbus_message_iter_open_container(&array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    const char *name = "Bands";
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    add_equalizer_variant(&entry, name);
+    dbus_message_iter_close_container(&array, &entry);
+    dbus_message_iter_close_container(&iter, &array);
+
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &sub);
+    dbus_message_iter_close_container(&iter, &sub);
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+}
+
 static inline DBusMessage *get_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     const char *interface = NULL, *property = NULL;
     DBusMessage *reply;
@@ -579,10 +1393,11 @@ static inline DBusMessage *get_handler(DBusMessage *msg, ffmpegparams_t *ffmpegp
                 reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.Get.Error", "No such property");
             }
         } else if (strcmp(interface, IFACE_PLAYER) == 0) {
+            player_values.position = player_position(ffmpegparams);
             int index = binsearch(property, playerprop_names, sizeof(playerprop_names) / sizeof(playerprop_names[0]));
             if (index >= 0) {
                 if (index == METADATA_INDEX) {
-                    add_metadata_variant(&iter, ffmpegparams->fmt->metadata);
+                    add_metadata_variant(&iter, ffmpegparams);
                 } else {
                     if (index > METADATA_INDEX)
                         index--;
@@ -593,6 +1408,35 @@ static inline DBusMessage *get_handler(DBusMessage *msg, ffmpegparams_t *ffmpegp
                 dbus_message_unref(reply);
                 reply = dbus_message_new_error(msg, "org.freedesktop.Properties.Get.Error", "No such property");
             }
+        } else if (strcmp(interface, IFACE_TINYAUDIO) == 0) {
+            int index =
+                binsearch(property, tinyaudioprop_names, sizeof(tinyaudioprop_names) / sizeof(tinyaudioprop_names[0]));
+            if (index >= 0) {
+                PropertyValue *pv = &tinyaudioprop_values[index];
+                add_basic_variant(&iter, pv->type, pv->value);
+            } else {
+                dbus_message_unref(reply);
+                reply = dbus_message_new_error(msg, "org.freedesktop.Properties.Get.Error", "No such property");
+            }
+        } else if (strcmp(interface, IFACE_EQUALIZER) == 0) {
+            if (!add_equalizer_variant(&iter, property)) {
+                dbus_message_unref(reply);
+                reply = dbus_message_new_error(msg, "org.freedesktop.Properties.Get.Error", "No such property");
+            }
+        } else if (strcmp(interface, IFACE_TRACKLIST) == 0) {
+            if (strcmp(property, "Tracks") == 0) {
+                DBusMessageIter variant, array;
+                dbus_message_iter_open_container(&iter, DBUS_TYPE_VARIANT, "ao", &variant);
+                dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "o", &array);
+                add_tracks(&array);
+                dbus_message_iter_close_container(&variant, &array);
+                dbus_message_iter_close_container(&iter, &variant);
+            } else if (strcmp(property, "CanEditTracks") == 0) {
+                add_basic_variant(&iter, DBUS_TYPE_BOOLEAN, &can_edit_tracks);
+            } else {
+                dbus_message_unref(reply);
+                reply = dbus_message_new_error(msg, "org.freedesktop.Properties.Get.Error", "No such property");
+            }
         } else {
             dbus_message_unref(reply);
             reply = dbus_message_new_error(msg, "org.freedesktop.Properties.Get.Error", "No such interface");
@@ -604,27 +1448,125 @@ static inline DBusMessage *get_handler(DBusMessage *msg, ffmpegparams_t *ffmpegp
     return reply;
 }
 
-static inline DBusMessage *set_handler(DBusMessage *msg) {
+static inline dbus_bool_t get_value_arg(DBusMessage *msg, int type, void *value) {
+    DBusMessageIter iter, variant;
+    dbus_message_iter_init(msg, &iter);
+    if (!dbus_message_iter_next(&iter) || !dbus_message_iter_next(&iter))
+        return FALSE;
+    if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT)
+        return FALSE;
+    dbus_message_iter_recurse(&iter, &variant);
+    if (dbus_message_iter_get_arg_type(&variant) != type)
+        return FALSE;
+    dbus_message_iter_get_basic(&variant, value);
+    return TRUE;
+}
+
+static inline DBusMessage *set_handler(DBusConnection *conn, DBusMessage *msg) {
     DBusMessage *reply;
     const char *interface, *property;
     if (!get_relevant_args(msg, &interface, &property)) {
-        reply = dbus_message_new_error(msg, "org.mpris.MediaPlayer2.tinyaudio.Error",
-                                       "Expected interface and property arguments");
-    } else {
-        reply = dbus_message_new_method_return(msg);
+        return dbus_message_new_error(msg, "org.mpris.MediaPlayer2.tinyaudio.Error",
+                                      "Expected interface and property arguments");
     }
     if (strcmp(interface, IFACE_PLAYER) == 0) {
         if (strcmp(property, "LoopStatus") == 0) {
-            reply = dbus_message_new_method_return(msg);
+            const char *value;
+            int index = -1;
+            if (get_value_arg(msg, DBUS_TYPE_STRING, &value))
+                index = binsearch(value, loop_statuses, sizeof(loop_statuses) / sizeof(loop_statuses[0]));
+            if (index >= 0) {
+                player_values.loop_status = loop_statuses[index];
+                update_navigation();
+                notify_property_changed(conn, IFACE_PLAYER, "LoopStatus", DBUS_TYPE_STRING,
+                                        &player_values.loop_status);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected None, Track or Playlist");
+            }
         } else if (strcmp(property, "Rate") == 0) {
-            reply = dbus_message_new_method_return(msg);
+            double value;
+            if (get_value_arg(msg, DBUS_TYPE_DOUBLE, &value) && value >= player_values.minimum_rate &&
+                value <= player_values.maximum_rate) {
+                if (value != player_values.rate) {
+                    clock_rebase();
+                    player_values.rate = value;
+                    notify_property_changed(conn, IFACE_PLAYER, "Rate", DBUS_TYPE_DOUBLE, &player_values.rate);
+                }
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Rate out of range");
+            }
         } else if (strcmp(property, "Shuffle") == 0) {
-            reply = dbus_message_new_method_return(msg);
+            dbus_bool_t value;
+            if (get_value_arg(msg, DBUS_TYPE_BOOLEAN, &value)) {
+                player_values.shuffle = value;
+                tracklist_set_shuffle(&tracklist, value);
+                checkpoint.queue_changed = TRUE;
+                update_navigation();
+                notify_property_changed(conn, IFACE_PLAYER, "Shuffle", DBUS_TYPE_BOOLEAN, &player_values.shuffle);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a boolean");
+            }
         } else if (strcmp(property, "Volume") == 0) {
             reply = dbus_message_new_method_return(msg);
         } else {
             reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.Set.Error", "No such property");
         }
+    } else if (strcmp(interface, IFACE_TINYAUDIO) == 0) {
+        if (strcmp(property, "Resampler") == 0) {
+            const char *value;
+            int profile = -1;
+            if (get_value_arg(msg, DBUS_TYPE_STRING, &value))
+                profile = resample_profile_from_name(value);
+            if (profile >= 0) {
+                resample_profile = profile;
+                tinyaudio_values.resampler = resample_profile_names[profile];
+                notify_property_changed(conn, IFACE_TINYAUDIO, "Resampler", DBUS_TYPE_STRING,
+                                        &tinyaudio_values.resampler);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected default, fast or hq");
+            }
+        } else if (strcmp(property, "Dither") == 0) {
+            const char *value;
+            int dither = -1;
+            if (get_value_arg(msg, DBUS_TYPE_STRING, &value))
+                dither = binsearch(value, output_dither_names, DITHERS);
+            if (dither >= 0) {
+                output.dither = dither;
+                output_reset(&output);
+                tinyaudio_values.dither = output_dither_names[dither];
+                notify_property_changed(conn, IFACE_TINYAUDIO, "Dither", DBUS_TYPE_STRING, &tinyaudio_values.dither);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected none, shaped or tpdf");
+            }
+        } else {
+            reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.Set.Error", "No such property");
+        }
+    } else if (strcmp(interface, IFACE_EQUALIZER) == 0) {
+        if (strcmp(property, "Enabled") == 0) {
+            dbus_bool_t value;
+            if (get_value_arg(msg, DBUS_TYPE_BOOLEAN, &value)) {
+                dsp_set_enabled(&dsp, value);
+                notify_property_changed(conn, IFACE_EQUALIZER, "Enabled", DBUS_TYPE_BOOLEAN, &value);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a boolean");
+            }
+        } else if (strcmp(property, "Preamp") == 0) {
+            double value;
+            if (get_value_arg(msg, DBUS_TYPE_DOUBLE, &value) && !dsp_set_preamp(&dsp, value)) {
+                notify_property_changed(conn, IFACE_EQUALIZER, "Preamp", DBUS_TYPE_DOUBLE, &dsp.preamp);
+                reply = dbus_message_new_method_return(msg);
+            } else {
+                reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a gain between -24 and 24 dB");
+            }
+        } else {
+            reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.Set.Error", "No such property");
+        }
     } else {
         reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.Set.Error", "No such interface");
     }
@@ -663,6 +1605,7 @@ static inline DBusMessage *getall_handler(DBusMessage *msg, ffmpegparams_t *ffmp
             }
         }));
     } else if (strcmp(interface, IFACE_PLAYER) == 0) {
+        player_values.position = player_position(ffmpegparams);
         reply = dbus_message_new_method_return(msg);
         DBusMessageIter iter, sub[2];
         dbus_message_iter_init_append(reply, &iter);
@@ -671,25 +1614,62 @@ static inline DBusMessage *getall_handler(DBusMessage *msg, ffmpegparams_t *ffmp
             PropertyValue *pv = &playerprop_values[i];
             add_dict_entry(&sub[0], playerprop_names[i], pv->type, pv->value);
         }
-        if (ffmpegparams->fmt)
-            add_metadata_dict_entry(&sub[0], ffmpegparams->fmt->metadata);
+        add_metadata_dict_entry(&sub[0], ffmpegparams);
         for (unsigned int i = METADATA_INDEX; i < sizeof(playerprop_values) / sizeof(playerprop_values[0]); i++) {
             PropertyValue *pv = &playerprop_values[i];
             add_dict_entry(&sub[0], playerprop_names[i + 1], pv->type, pv->value);
         }
         dbus_message_iter_close_container(&iter, &sub[0]);
+    } else if (strcmp(interface, IFACE_TINYAUDIO) == 0) {
+        reply = dbus_message_new_method_return(msg);
+        DBusMessageIter iter;
+        dbus_message_iter_init_append(reply, &iter);
+        ADD_CONTAINER(&iter, DBUS_TYPE_ARRAY, "{sv}", ({
+            for (unsigned int i = 0; i < sizeof(tinyaudioprop_values) / sizeof(tinyaudioprop_values[0]); i++) {
+                PropertyValue *pv = &tinyaudioprop_values[i];
+                add_dict_entry(&container, tinyaudioprop_names[i], pv->type, pv->value);
+            }
+        }));
+    } else if (strcmp(interface, IFACE_EQUALIZER) == 0) {
+        reply = dbus_message_new_method_return(msg);
+        DBusMessageIter iter, array, dict;
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &array);
+        for (unsigned int i = 0; i < sizeof(equalizerprop_names) / sizeof(equalizerprop_names[0]); i++) {
+            dbus_message_iter_open_container(&array, DBUS_TYPE_DICT_ENTRY, NULL, &dict);
+            dbus_message_iter_append_basic(&dict, DBUS_TYPE_STRING, &equalizerprop_names[i]);
+            add_equalizer_variant(&dict, equalizerprop_names[i]);
+            dbus_message_iter_close_container(&array, &dict);
+        }
+        dbus_message_iter_close_container(&iter, &array);
+    } else if (strcmp(interface, IFACE_TRACKLIST) == 0) {
+        reply = dbus_message_new_method_return(msg);
+        DBusMessageIter iter;
+        dbus_message_iter_init_append(reply, &iter);
+        ADD_CONTAINER(&iter, DBUS_TYPE_ARRAY, "{sv}", ({
+            add_dict_entry(&container, "CanEditTracks", DBUS_TYPE_BOOLEAN, &can_edit_tracks);
+            ADD_DICT_ENTRY(&container, "Tracks", ({
+                DBusMessageIter variant, array;
+                dbus_message_iter_open_container(&dict, DBUS_TYPE_VARIANT, "ao", &variant);
+                dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "o", &array);
+                add_tracks(&array);
+                dbus_message_iter_close_container(&variant, &array);
+                dbus_message_iter_close_container(&dict, &variant);
+            }));
+        }));
     } else {
         reply = dbus_message_new_error(msg, "org.freedesktop.DBus.Properties.GetAll.Error", "No such interface");
     }
     return reply;
 }
 
-static inline DBusMessage *properties_handler(DBusMessage *msg, const char *member, ffmpegparams_t *ffmpegparams) {
+static inline DBusMessage *properties_handler(DBusConnection *conn, DBusMessage *msg, const char *member,
+                                              ffmpegparams_t *ffmpegparams) {
     int cmp = strcmp(member, "GetAll");
     if (cmp < 0 && strcmp(member, "Get") == 0)
         return get_handler(msg, ffmpegparams);
     else if (cmp > 0 && strcmp(member, "Set") == 0)
-        return set_handler(msg);
+        return set_handler(conn, msg);
     else
         return getall_handler(msg, ffmpegparams);
     return NULL;
@@ -713,6 +1693,8 @@ static inline DBusMessage *player_handler(DBusMessage *msg, const char *member,
             return openuri_handler(msg, ffmpegparams);
         } else if (cmp < 0 && strcmp("Pause", member) == 0) {
             return pause_handler(msg, ffmpegparams);
+        } else if (cmp > 0 && strcmp("Next", member) == 0) {
+            return next_handler(msg, ffmpegparams);
         }
     } else if (cmp < 0) {
         int cmp = strcmp("Stop", member);
@@ -720,6 +1702,12 @@ static inline DBusMessage *player_handler(DBusMessage *msg, const char *member,
             return stop_handler(msg, ffmpegparams);
         } else if (cmp > 0 && strcmp("PlayPause", member) == 0) {
             return playpause_handler(msg, ffmpegparams);
+        } else if (cmp > 0 && strcmp("Previous", member) == 0) {
+            return previous_handler(msg, ffmpegparams);
+        } else if (cmp > 0 && strcmp("Seek", member) == 0) {
+            return seek_handler(msg, ffmpegparams);
+        } else if (cmp > 0 && strcmp("SetPosition", member) == 0) {
+            return setposition_handler(msg, ffmpegparams);
         }
     } else {
         return play_handler(msg, ffmpegparams);
@@ -727,6 +1715,308 @@ static inline DBusMessage *player_handler(DBusMessage *msg, const char *member,
     return NULL;
 }
 
+static inline DBusMessage *gettracksmetadata_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    DBusMessageIter args, ids;
+    if (!dbus_message_iter_init(msg, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY ||
+        dbus_message_iter_get_element_type(&args) != DBUS_TYPE_OBJECT_PATH)
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected an array of track ids");
+    dbus_message_iter_recurse(&args, &ids);
+
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    DBusMessageIter iter;
+    dbus_message_iter_init_append(reply, &iter);
+    ADD_CONTAINER(&iter, DBUS_TYPE_ARRAY, "a{sv}", ({
+        int budget = METADATA_PROBES_PER_CALL;
+        for (; dbus_message_iter_get_arg_type(&ids) == DBUS_TYPE_OBJECT_PATH; dbus_message_iter_next(&ids)) {
+            const char *path;
+            dbus_message_iter_get_basic(&ids, &path);
+            uint32_t track = path_track(path);
+            if (track == TRACK_NONE)
+                continue;
+
+            AVDictionary *tags = NULL;
+            int64_t duration = -1;
+            if (track == tracklist_current(&tracklist) && ffmpegparams->fmt) {
+                tags = stream_metadata(ffmpegparams);
+                duration = current_duration(ffmpegparams);
+            } else {
+                tags = probe_metadata(track, &duration, &budget);
+            }
+            DBusMessageIter map;
+            dbus_message_iter_open_container(&container, DBUS_TYPE_ARRAY, "{sv}", &map);
+            add_metadata_entries(&map, track, tags, duration);
+            dbus_message_iter_close_container(&container, &map);
+        }
+    }));
+    return reply;
+}
+
+static inline DBusMessage *goto_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    const char *path;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a track id");
+    uint32_t track = path_track(path);
+    if (track == TRACK_NONE || tracklist_goto(&tracklist, track))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "No such track");
+    flush_pending = TRUE;
+    ffmpegparams_free(ffmpegparams);
+    if (!open_current(ffmpegparams))
+        set_playing();
+    else
+        set_stopped();
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *tracklist_handler(DBusMessage *msg, const char *member, ffmpegparams_t *ffmpegparams) {
+    if (strcmp("GetTracksMetadata", member) == 0) {
+        return gettracksmetadata_handler(msg, ffmpegparams);
+    } else if (strcmp("GoTo", member) == 0) {
+        return goto_handler(msg, ffmpegparams);
+    } else if (strcmp("AddTrack", member) == 0 || strcmp("RemoveTrack", member) == 0) {
+        // NOTE: CanEditTracks is false, and the spec asks for these to be no-ops in that case.
+        return dbus_message_new_method_return(msg);
+    }
+    return NULL;
+}
+
+typedef struct {
+    char *path; // a copy, as library_default_path returns a buffer the main loop may be using
+    char **roots;
+    int nroots;
+} scan_args_t;
+
+static void *scan_thread(void *arg) {
+    scan_args_t *args = arg;
+    library_scan(args->path, (const char *const *)args->roots, args->nroots);
+    free(args->path);
+    dbus_free_string_array(args->roots);
+    free(args);
+    atomic_store(&scan_state, SCAN_DONE);
+    return NULL;
+}
+
+static inline DBusMessage *scan_handler(DBusMessage *msg) {
+    scan_args_t *args = malloc(sizeof(scan_args_t));
+    if (!args)
+        return dbus_message_new_error(msg, DBUS_ERROR_NO_MEMORY, "Out of memory");
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &args->roots, &args->nroots,
+                               DBUS_TYPE_INVALID)) {
+        free(args);
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected an array of directories");
+    }
+
+    args->path = strdup(library_default_path());
+    if (!args->path) {
+        dbus_free_string_array(args->roots);
+        free(args);
+        return dbus_message_new_error(msg, DBUS_ERROR_NO_MEMORY, "Out of memory");
+    }
+
+    int idle = SCAN_IDLE;
+    if (!atomic_compare_exchange_strong(&scan_state, &idle, SCAN_RUNNING)) {
+        free(args->path);
+        dbus_free_string_array(args->roots);
+        free(args);
+        return dbus_message_new_error(msg, "org.mpris.MediaPlayer2.tinyaudio.Error", "A scan is already running");
+    }
+    // NOTE: scanning runs next to playback and reports back through scan_state; the index it writes is only mapped
+    // by the main loop once the scan has finished.
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, scan_thread, args) != 0) {
+        atomic_store(&scan_state, SCAN_IDLE);
+        free(args->path);
+        dbus_free_string_array(args->roots);
+        free(args);
+        return dbus_message_new_error(msg, "org.mpris.MediaPlayer2.tinyaudio.Error", "Failed to start scan");
+    }
+    pthread_detach(thread);
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *search_handler(DBusMessage *msg) {
+    static const char *field_names[] = {"album", "artist", "path", "title"};
+    static const enum library_field fields[] = {FIELD_ALBUM, FIELD_ARTIST, FIELD_PATH, FIELD_TITLE};
+    const char *name, *prefix;
+    dbus_uint32_t limit;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &prefix, DBUS_TYPE_UINT32,
+                               &limit, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected field, prefix and limit");
+    int index = binsearch(name, field_names, sizeof(field_names) / sizeof(field_names[0]));
+    if (index < 0)
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Field must be album, artist, path or title");
+
+    uint32_t first = 0;
+    uint32_t n = library.map ? library_find(&library, fields[index], prefix, &first) : 0;
+    if (limit && n > limit)
+        n = limit;
+
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    DBusMessageIter iter;
+    dbus_message_iter_init_append(reply, &iter);
+    ADD_CONTAINER(&iter, DBUS_TYPE_ARRAY, "(ssss)", ({
+        for (uint32_t i = first; i < first + n; i++) {
+            uint32_t row = library.sorted[fields[index]][i];
+            const char *path = library_field(&library, row, FIELD_PATH);
+            if (!dbus_validate_utf8(path, NULL))
+                continue;
+            DBusMessageIter track;
+            dbus_message_iter_open_container(&container, DBUS_TYPE_STRUCT, NULL, &track);
+            dbus_message_iter_append_basic(&track, DBUS_TYPE_STRING, &path);
+            for (int f = FIELD_ARTIST; f <= FIELD_TITLE; f++) {
+                const char *value = library_field(&library, row, f);
+                if (!dbus_validate_utf8(value, NULL))
+                    value = "";
+                dbus_message_iter_append_basic(&track, DBUS_TYPE_STRING, &value);
+            }
+            dbus_message_iter_close_container(&container, &track);
+        }
+    }));
+    return reply;
+}
+
+static inline DBusMessage *set_band_handler(DBusConnection *conn, DBusMessage *msg) {
+    dbus_uint32_t index;
+    const char *type;
+    double frequency, gain, q;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &index, DBUS_TYPE_STRING, &type, DBUS_TYPE_DOUBLE,
+                               &frequency, DBUS_TYPE_DOUBLE, &gain, DBUS_TYPE_DOUBLE, &q, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected index, type, frequency, gain and Q");
+    int t = binsearch(type, eq_type_names, EQ_TYPES);
+    if (t < 0)
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS,
+                                      "Expected high_pass, high_shelf, low_pass, low_shelf or peak");
+    if (dsp_set_band(&dsp, index, t, frequency, gain, q))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Band out of range");
+    notify_bands_changed(conn);
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *equalizer_handler(DBusConnection *conn, DBusMessage *msg, const char *member) {
+    if (strcmp("SetBand", member) == 0)
+        return set_band_handler(conn, msg);
+    else if (strcmp("RemoveBand", member) == 0) {
+        dbus_uint32_t index;
+        if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &index, DBUS_TYPE_INVALID) ||
+            dsp_remove_band(&dsp, index))
+            return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "No such band");
+        notify_bands_changed(conn);
+        return dbus_message_new_method_return(msg);
+    }
+    return NULL;
+}
+
+static inline DBusMessage *library_handler(DBusMessage *msg, const char *member) {
+    if (strcmp("Search", member) == 0)
+        return search_handler(msg);
+    else if (strcmp("Scan", member) == 0)
+        return scan_handler(msg);
+    return NULL;
+}
+
+static inline void tap_match_rule(char *rule, size_t size, const char *name) {
+    snprintf(rule, size,
+             "type='signal',sender='" DBUS_SERVICE_DBUS "',interface='" DBUS_INTERFACE_DBUS
+             "',member='NameOwnerChanged',arg0='%s'",
+             name);
+}
+
+static inline int find_tap_client(const char *name) {
+    for (int i = 0; i < tap_clients.count; i++)
+        if (strcmp(tap_clients.names[i], name) == 0)
+            return i;
+    return -1;
+}
+
+// Clients are watched through NameOwnerChanged, so one that exits without calling CloseTap is dropped as well.
+static inline void remove_tap_client(DBusConnection *conn, const char *name) {
+    int i = find_tap_client(name);
+    if (i < 0)
+        return;
+    char rule[256];
+    tap_match_rule(rule, sizeof(rule), name);
+    dbus_bus_remove_match(conn, rule, NULL);
+    free(tap_clients.names[i]);
+    tap_clients.names[i] = tap_clients.names[--tap_clients.count];
+}
+
+static inline DBusMessage *open_tap_handler(DBusConnection *conn, DBusMessage *msg) {
+    const char *sender = dbus_message_get_sender(msg);
+    if (!dbus_connection_can_send_type(conn, DBUS_TYPE_UNIX_FD))
+        return dbus_message_new_error(msg, DBUS_ERROR_NOT_SUPPORTED, "The bus cannot pass file descriptors");
+    if (find_tap_client(sender) < 0 && tap_clients.count == TAP_MAX_CLIENTS)
+        return dbus_message_new_error(msg, DBUS_ERROR_LIMITS_EXCEEDED, "Too many tap clients");
+    if (tap_open(&tap, SAMPLE_RATE, CHANNELS))
+        return dbus_message_new_error(msg, DBUS_ERROR_FAILED, "Failed to create the tap");
+    int fd = tap_reader_fd(&tap);
+    if (fd < 0)
+        return dbus_message_new_error(msg, DBUS_ERROR_FAILED, "Failed to open the tap");
+
+    if (find_tap_client(sender) < 0) {
+        char rule[256];
+        tap_match_rule(rule, sizeof(rule), sender);
+        dbus_bus_add_match(conn, rule, NULL);
+        tap_clients.names[tap_clients.count++] = strdup(sender);
+    }
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    dbus_message_append_args(reply, DBUS_TYPE_UNIX_FD, &fd, DBUS_TYPE_INVALID);
+    close(fd);
+    return reply;
+}
+
+static inline DBusMessage *start_recording_handler(DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
+    const char *path;
+    dbus_bool_t split;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &path, DBUS_TYPE_BOOLEAN, &split, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected a path and a boolean");
+    if (path[0] != '/')
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "The path must be absolute");
+    if (!ffmpegparams->fmt)
+        return dbus_message_new_error(msg, DBUS_ERROR_FAILED, "Nothing is playing");
+
+    stop_recording();
+    const char *error;
+    recording = recorder_start(path, ffmpegparams->fmt->streams[ffmpegparams->astream], &error);
+    if (!recording)
+        return dbus_message_new_error(msg, DBUS_ERROR_FAILED, error);
+    recording_path = strdup(path);
+    tinyaudio_values.recording = recording_path ? recording_path : "";
+    tinyaudio_values.recording_dropped = 0;
+    recording_split = split;
+    if (split)
+        split_recording(stream_metadata(ffmpegparams));
+    return dbus_message_new_method_return(msg);
+}
+
+static inline DBusMessage *tinyaudio_handler(DBusConnection *conn, DBusMessage *msg, const char *member,
+                                             ffmpegparams_t *ffmpegparams) {
+    if (strcmp("OpenTap", member) == 0)
+        return open_tap_handler(conn, msg);
+    else if (strcmp("CloseTap", member) == 0) {
+        remove_tap_client(conn, dbus_message_get_sender(msg));
+        return dbus_message_new_method_return(msg);
+    } else if (strcmp("StartRecording", member) == 0)
+        return start_recording_handler(msg, ffmpegparams);
+    else if (strcmp("StopRecording", member) == 0) {
+        stop_recording();
+        return dbus_message_new_method_return(msg);
+    }
+    return NULL;
+}
+
+// Maps the index written by a finished scan and tells clients about it.
+void reload_library(DBusConnection *connection) {
+    int done = SCAN_DONE;
+    if (!atomic_compare_exchange_strong(&scan_state, &done, SCAN_IDLE))
+        return;
+    library_close(&library);
+    library_open(&library, library_default_path());
+
+    DBusMessage *signal = dbus_message_new_signal(OBJ_PATH, IFACE_LIBRARY, "Updated");
+    dbus_message_append_args(signal, DBUS_TYPE_UINT32, &library.count, DBUS_TYPE_INVALID);
+    dbus_connection_send(connection, signal, NULL);
+    dbus_message_unref(signal);
+}
+
 static inline void handle_message(DBusConnection *conn, DBusMessage *msg, ffmpegparams_t *ffmpegparams) {
     DBusMessage *reply = NULL;
 
@@ -735,14 +2025,26 @@ static inline void handle_message(DBusConnection *conn, DBusMessage *msg, ffmpeg
         const char *member = dbus_message_get_member(msg);
 
         if (strcmp(DBUS_INTERFACE_PROPERTIES, iface) == 0)
-            reply = properties_handler(msg, member, ffmpegparams);
+            reply = properties_handler(conn, msg, member, ffmpegparams);
         else if (strcmp(IFACE_PLAYER, iface) == 0) {
             enum status_t old_status = status;
             reply = player_handler(msg, member, ffmpegparams);
             if (old_status != status) {
                 notify_playback_status_changed(conn, player_values.playback_status);
             }
-        } else if (strcmp(IFACE_ROOT, iface) == 0)
+        } else if (strcmp(IFACE_TRACKLIST, iface) == 0) {
+            enum status_t old_status = status;
+            reply = tracklist_handler(msg, member, ffmpegparams);
+            if (old_status != status) {
+                notify_playback_status_changed(conn, player_values.playback_status);
+            }
+        } else if (strcmp(IFACE_LIBRARY, iface) == 0)
+            reply = library_handler(msg, member);
+        else if (strcmp(IFACE_TINYAUDIO, iface) == 0)
+            reply = tinyaudio_handler(conn, msg, member, ffmpegparams);
+        else if (strcmp(IFACE_EQUALIZER, iface) == 0)
+            reply = equalizer_handler(conn, msg, member);
+        else if (strcmp(IFACE_ROOT, iface) == 0)
             reply = root_handler(msg, member);
         else if (strcmp(DBUS_INTERFACE_INTROSPECTABLE, iface) == 0 && strcmp("Introspect", member) == 0) {
             reply = dbus_message_new_method_return(msg);
@@ -756,9 +2058,163 @@ static inline void handle_message(DBusConnection *conn, DBusMessage *msg, ffmpeg
         dbus_connection_send(conn, reply, NULL);
         dbus_message_unref(reply);
         dbus_connection_flush(conn);
+    } else if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+        const char *name, *old_owner, *new_owner;
+        if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING,
+                                  &new_owner, DBUS_TYPE_INVALID) &&
+            !*new_owner)
+            remove_tap_client(conn, name);
+    }
+}
+
+// Sleeps until a D-Bus message arrives or timeout_ms passes, whichever comes first.
+// Also returns as soon as fd, unless it is negative, has something to read.
+void wait_for_dbus(DBusConnection *conn, int fd, int timeout_ms) {
+    // poll ignores negative fds, so without either this just sleeps.
+    struct pollfd pfd[2] = {{.fd = -1, .events = POLLIN}, {.fd = fd, .events = POLLIN}};
+    int bus_fd;
+    if (dbus_connection_get_unix_fd(conn, &bus_fd))
+        pfd[0].fd = bus_fd;
+    poll(pfd, 2, timeout_ms);
+}
+
+void update_wakeups() {
+    static int64_t last_time = 0;
+    static long last_switches = 0;
+    int64_t now = av_gettime_relative();
+    if (now - last_time < WAKEUP_REPORT_INTERVAL)
+        return;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    if (last_time) {
+        tinyaudio_values.wakeups_per_second = (usage.ru_nvcsw - last_switches) * 1000000.0 / (now - last_time);
+        syslog(LOG_DEBUG, "%.1f wakeups per second (%s mode)\n", tinyaudio_values.wakeups_per_second,
+               tinyaudio_values.burst_mode ? "burst" : "normal");
+    }
+    last_time = now;
+    last_switches = usage.ru_nvcsw;
+}
+
+void flush_burst(audio_t *audio) {
+    if (burst.fill > 0)
+        writeaudio(audio, burst.data, burst.fill);
+    burst.fill = 0;
+    clock_sync(audio);
+}
+
+// How long until the sink has room for everything in the burst buffer, 0 if it has now.
+static inline int64_t burst_wait(audio_t *audio) {
+    int64_t wait = latencyaudio(audio) + burst_duration() - BURST_SINK_LENGTH;
+    return wait > 0 ? wait : 0;
+}
+
+// Drops everything queued for playback and moves the decoder back to what is audible right now. Used when pausing in
+// burst mode, where the sink holds far too much audio to just let it play out.
+void rewind_sink(audio_t *audio, ffmpegparams_t *ffmpegparams) {
+    int64_t played = decoded_ts - latencyaudio(audio) - burst_duration();
+    flushaudio(audio);
+    burst.fill = 0;
+    if (ffmpegparams->fmt && decoded_ts != AV_NOPTS_VALUE && played > 0) {
+        clock_reset(played);
+        av_seek_frame(ffmpegparams->fmt, -1, played, AVSEEK_FLAG_BACKWARD);
+        avcodec_flush_buffers(ffmpegparams->cc);
     }
 }
 
+void play_frame(audio_t *audio, ffmpegparams_t *ffmpegparams, AVFrame *frm, dbus_bool_t bursting) {
+    AVRational time_base = ffmpegparams->fmt->streams[ffmpegparams->astream]->time_base;
+    int64_t duration = av_rescale(frm->nb_samples, AV_TIME_BASE, ffmpegparams->cc->sample_rate);
+    if (frm->best_effort_timestamp != AV_NOPTS_VALUE)
+        decoded_ts = av_rescale_q(frm->best_effort_timestamp, time_base, AV_TIME_BASE_Q) + duration;
+    else
+        decoded_ts = (decoded_ts == AV_NOPTS_VALUE ? 0 : decoded_ts) + duration;
+    int out_samples =
+        av_rescale_rnd(swr_get_delay(ffmpegparams->swr, ffmpegparams->cc->sample_rate) + frm->nb_samples, SAMPLE_RATE,
+                       ffmpegparams->cc->sample_rate, AV_ROUND_UP);
+    if (bursting) {
+        // Whatever does not fit stays buffered in the resampler until the burst has been written.
+        uint8_t *outbuf = (uint8_t *)(burst.data + (size_t)burst.fill * CHANNELS);
+        int n = swr_convert(ffmpegparams->swr, &outbuf, burst.capacity - burst.fill, (const uint8_t **)frm->data,
+                            frm->nb_samples);
+        if (n > 0) {
+            dsp_process(&dsp, (float *)outbuf, n);
+            burst.fill += n;
+        }
+    } else {
+        if (burst.fill > 0)
+            flush_burst(audio); // a remote track or a tap client follows a burst
+        uint8_t *outbuf = NULL;
+        av_samples_alloc(&outbuf, NULL, CHANNELS, out_samples, AV_SAMPLE_FMT_FLT, 0);
+        int n = swr_convert(ffmpegparams->swr, &outbuf, out_samples, (const uint8_t **)frm->data, frm->nb_samples);
+        int frames = n;
+        if (frames > 0)
+            dsp_process(&dsp, (float *)outbuf, frames);
+        // What the sink holds ahead of this frame, from the audio clock rather than asking the sink for every frame.
+        if (tap_clients.count && frames > 0) {
+            int64_t delay = decoded_ts - duration - clock_position();
+            tap_write(&tap, (const float *)outbuf, frames, delay > 0 ? delay : 0);
+        }
+        writeaudio(audio, (float *)outbuf, frames);
+        clock_sync(audio);
+        av_freep(&outbuf);
+    }
+    if (dropout.gap_pending)
+        record_gap();
+}
+
+// Runs files through the decoder, resampler, DSP and output stages of playback as fast as they go and prints how many
+// times faster than real time that is. Returns a process exit code.
+int decode_bench(char **files) {
+    int result = 0;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frm = av_frame_alloc();
+    uint8_t *outbuf = NULL;
+    int out_cap = 0;
+    openlog(APP_NAME, LOG_PERROR, 0);
+    dsp_init(&dsp, SAMPLE_RATE);
+    output_init(&output, output_format, DITHER_TPDF);
+    printf("%-32s %9s %9s %9s\n", "file", "audio", "cpu", "speed");
+    for (; *files; files++) {
+        ffmpegparams_t p = {0};
+        if (openuri(*files, &p)) {
+            fprintf(stderr, "Failed to open %s\n", *files);
+            result = 1;
+            continue;
+        }
+        int64_t frames = 0;
+        double start = cpu_seconds();
+        while (av_read_frame(p.fmt, pkt) >= 0) {
+            if (pkt->stream_index == p.astream && avcodec_send_packet(p.cc, pkt) == 0) {
+                while (avcodec_receive_frame(p.cc, frm) == 0) {
+                    int n = swr_get_out_samples(p.swr, frm->nb_samples);
+                    if (n > out_cap) {
+                        av_freep(&outbuf);
+                        av_samples_alloc(&outbuf, NULL, CHANNELS, n, AV_SAMPLE_FMT_FLT, 0);
+                        out_cap = n;
+                    }
+                    n = swr_convert(p.swr, &outbuf, out_cap, (const uint8_t **)frm->data, frm->nb_samples);
+                    if (n > 0) {
+                        dsp_process(&dsp, (float *)outbuf, n);
+                        output_convert(&output, (float *)outbuf, n);
+                        frames += n;
+                    }
+                }
+            }
+            av_packet_unref(pkt);
+        }
+        double cpu = cpu_seconds() - start, seconds = (double)frames / SAMPLE_RATE;
+        const char *name = strrchr(*files, '/') ? strrchr(*files, '/') + 1 : *files;
+        printf("%-32s %8.1fs %8.3fs %8.0fx\n", name, seconds, cpu, seconds / cpu);
+        ffmpegparams_free(&p);
+    }
+    av_freep(&outbuf);
+    av_frame_free(&frm);
+    av_packet_free(&pkt);
+    resample_free_all();
+    return result;
+}
+
 static inline dbus_bool_t handle_dbus_error(DBusError *e, const char *msg) {
     if (dbus_error_is_set(e)) {
         syslog(LOG_ERR, "%s: %s\n", msg, e->message);
@@ -770,7 +2226,48 @@ static inline dbus_bool_t handle_dbus_error(DBusError *e, const char *msg) {
 }
 
 const char *process_command_line(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "bf:n:r:t")) != -1) {
+        switch (opt) {
+            case 'b':
+                tinyaudio_values.burst_mode = TRUE;
+                break;
+            case 'f':
+                if (binsearch(optarg, output_format_names, OUTPUT_FORMATS) < 0) {
+                    argc = 0;
+                    break;
+                }
+                output_format = binsearch(optarg, output_format_names, OUTPUT_FORMATS);
+                break;
+            case 'n':
+                rtp_address = optarg;
+                break;
+            case 't':
+                tinyaudio_values.timeshift = TRUE;
+                break;
+            case 'r':
+                if (resample_profile_from_name(optarg) < 0) {
+                    argc = 0;
+                    break;
+                }
+                resample_profile = resample_profile_from_name(optarg);
+                tinyaudio_values.resampler = resample_profile_names[resample_profile];
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    // Shift the options away so that the command is argv[1].
+    argv[optind - 1] = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc > 1) {
+        if (strcmp("bench", argv[1]) == 0)
+            return "Bench";
+        if (strcmp("receive", argv[1]) == 0 && argc == 3)
+            return "Receive";
         int cmp = strcmp("play", argv[1]);
         if (cmp > 0 && strcmp("pause", argv[1]) == 0) {
             return "Pause";
@@ -787,8 +2284,19 @@ const char *process_command_line(int argc, char *argv[]) {
             return "Play";
         }
     }
-    printf("USAGE: %s (play [uri] | pause | stop | quit)\nStart playback of an internet audio stream, music file or "
-           "playlist or control the player running in the background.",
+    printf("USAGE: %s [-b] [-f format] [-n host:port] [-r profile] [-t] (play [uri] | pause | stop | quit | "
+           "bench [file...] | receive host:port)\nStart playback of an internet "
+           "audio stream, music file or playlist or control the player running in the background. play without a uri "
+           "starts the player where it left off when it last quit.\n\n"
+           "  -b  burst mode: decode local files many seconds ahead and sleep in between to save power\n"
+           "  -f  sample format of the sound server stream: s16 (dithered, the default), s24, s32 or float\n"
+           "  -n  stream to a multicast group, or a single host, instead of playing locally\n"
+           "  -r  resampler profile: fast, default or hq\n"
+           "  -t  timeshift: keep receiving live streams while paused, and allow seeking back\n"
+           "bench compares the CPU cost and quality of the resampler profiles and output conversions, or measures how "
+           "fast files decode.\n"
+           "receive plays, in sync with other receivers, what a player started with -n streams to host:port.\n"
+           "Options only take effect when starting the player.\n",
            argv[0]);
     return NULL;
 }
@@ -825,10 +2333,20 @@ void ffmpeg_log_handler(void *avcl, int av_level, const char *fmt, va_list vl) {
 
 int main(int argc, char **argv) {
     const char *method = process_command_line(argc, argv);
+    argv += optind - 1;
 
     if (!method)
         return 0;
 
+    const char *bench_method = "Bench";
+    if (method == bench_method)
+        return argv[2] ? decode_bench(argv + 2) : resample_bench() || output_bench();
+    const char *receive_method = "Receive";
+    if (method == receive_method) {
+        openlog(APP_NAME, LOG_PERROR, 0);
+        return rtp_receive(argv[2]);
+    }
+
     openlog(APP_NAME, LOG_CONS, 0);
     av_log_set_callback(ffmpeg_log_handler);
 
@@ -866,8 +2384,7 @@ int main(int argc, char **argv) {
         if (method == openuri_method) {
             DBusMessageIter it;
             dbus_message_iter_init_append(msg, &it);
-            uri = argv[2];
-            const char *s = uri;
+            const char *s = argv[2];
             if (!dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &s)) {
                 syslog(LOG_ERR, "Failed to append argument\n");
                 return 1;
@@ -886,12 +2403,17 @@ int main(int argc, char **argv) {
         dbus_message_unref(reply);
     } else {
         const char *openuri_method = "OpenUri";
-        if (method != openuri_method) {
+        const char *play_method = "Play";
+        state_t resume = {0};
+        if (method == play_method) {
+            if (state_load(state_path(STATE_FILE), &resume)) {
+                printf("Player is not running and there is nothing to resume\n");
+                return 0;
+            }
+        } else if (method != openuri_method) {
             printf("Player is not running\n");
             return 0;
         }
-        uri = argv[2];
-
         int ret = dbus_bus_request_name(dbus_conn, BUS_NAME, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
         if (handle_dbus_error(&err, "RequestName failed")) {
             return 1;
@@ -907,16 +2429,33 @@ int main(int argc, char **argv) {
                 syslog(LOG_ERR, "Failed to fork\n");
                 return 1;
             case 0:;
-                audio_t *audio = initaudio();
+                // Seeded once per daemon so that Shuffle differs between runs
+                srandom(av_get_random_seed());
+                timeshift_init(&timeshift);
+                dsp_init(&dsp, SAMPLE_RATE);
+                output_init(&output, rtp_address ? OUTPUT_S16 : output_format, DITHER_TPDF);
+                tinyaudio_values.sample_format = output_format_names[output.format];
+                audio_t *audio = initaudio(tinyaudio_values.burst_mode, rtp_address, output.format);
                 if (audio == NULL)
                     return 1;
-                if (openuri(uri, &ffmpegparams))
+                if (tinyaudio_values.burst_mode) {
+                    burst.frames = BURST_SECONDS * SAMPLE_RATE;
+                    burst.capacity = (BURST_SECONDS + BURST_HEADROOM) * SAMPLE_RATE;
+                    burst.data = av_malloc((size_t)burst.capacity * FRAME_BYTES);
+                    if (!burst.data)
+                        return 1;
+                }
+                library_open(&library, library_default_path());
+                if (method == play_method ? restore_state(&resume, &ffmpegparams) : load_uri(argv[2], &ffmpegparams))
                     return 1;
+                state_free(&resume);
                 set_playing();
 
                 AVFrame *frm = av_frame_alloc();
                 AVPacket *pkt = av_packet_alloc();
                 int error_count = 0;
+                int64_t last_dts = AV_NOPTS_VALUE;
+                enum status_t last_status = status;
                 // TODO: log when playback started
                 while (1) {
                     if (!dbus_connection_read_write(dbus_conn, 0)) {
@@ -928,56 +2467,153 @@ int main(int argc, char **argv) {
                         handle_message(dbus_conn, msg, &ffmpegparams);
                         dbus_message_unref(msg);
                     }
+                    notify_track_changes(dbus_conn, &ffmpegparams);
+                    reload_library(dbus_conn);
+                    update_wakeups();
                     if (status == QUITTING)
                         break;
-                    if (status != PLAYING) {
-                        // TODO: sleep value should depend on how long dbus method
-                        // handling took
-                        usleep(100000);
+                    if (checkpoint_due())
+                        save_state(&ffmpegparams);
+                    // A tap client wants to see what is playing now, not what plays in 15 seconds. RTP is sent in real
+                    // time, a burst handed to it would hold up the loop for as long as it plays.
+                    dbus_bool_t bursting = tinyaudio_values.burst_mode && !tap_clients.count && !audio->rtp &&
+                                           (burst.fill > 0 || (ffmpegparams.fmt && is_local(ffmpegparams.fmt->url)));
+                    if (flush_pending) {
+                        flushaudio(audio);
+                        burst.fill = 0;
+                        burst.draining = FALSE;
+                        dsp_reset(&dsp);
+                        output_reset(&output);
+                        flush_pending = FALSE;
+                    } else if (bursting && status == PAUSED && last_status == PLAYING) {
+                        rewind_sink(audio, &ffmpegparams);
+                    }
+                    if (status != last_status)
+                        audio_clock.synced_at = 0; // the sink has drained or been rewound in the meantime
+                    last_status = status;
+                    if (tinyaudio_values.timeshift && ffmpegparams.fmt && !is_local(ffmpegparams.fmt->url) &&
+                        !timeshift_attached(&timeshift) && !reconnect_running(&reconnect)) {
+                        av_dict_free(&ffmpegparams.metadata);
+                        av_dict_copy(&ffmpegparams.metadata, ffmpegparams.fmt->metadata, 0);
+                        if (!timeshift_attach(&timeshift, ffmpegparams.fmt, ffmpegparams.astream) &&
+                            !player_values.can_seek) {
+                            player_values.can_seek = TRUE;
+                            notify_property_changed(dbus_conn, IFACE_PLAYER, "CanSeek", DBUS_TYPE_BOOLEAN,
+                                                    &player_values.can_seek);
+                        }
+                    }
+                    if (audio->rtp)
+                        rtp_stats(audio->rtp, &tinyaudio_values.rtp_receivers, &tinyaudio_values.rtp_skew,
+                                  &tinyaudio_values.rtp_delay);
+                    if (timeshift_attached(&timeshift))
+                        timeshift_stats(&timeshift, &tinyaudio_values.timeshift_delay,
+                                        &tinyaudio_values.timeshift_window);
+                    AVFormatContext *reconnected;
+                    if (reconnect_running(&reconnect) && reconnect_poll(&reconnect, &reconnected)) {
+                        if (!reconnected || splice_input(&ffmpegparams, reconnected)) {
+                            syslog(LOG_ERR, "Giving up on reconnecting\n");
+                            ffmpegparams_free(&ffmpegparams);
+                            set_stopped();
+                            notify_playback_status_changed(dbus_conn, player_values.playback_status);
+                        }
+                    }
+                    if (burst.draining && burst_wait(audio) == 0) {
+                        flush_burst(audio);
+                        burst.draining = FALSE;
+                    }
+                    if (status != PLAYING || reconnect_running(&reconnect)) {
+                        wait_for_dbus(dbus_conn, -1, 100);
                         continue;
                     }
-                    int read_result = av_read_frame(ffmpegparams.fmt, pkt);
-                    if (read_result >= 0) {
-                        if (ffmpegparams.fmt->event_flags & AVFMT_EVENT_FLAG_METADATA_UPDATED) {
-                            AVDictionary *metadata = ffmpegparams.fmt->metadata;
-                            notify_metadata_changed(dbus_conn, metadata);
+                    if (bursting && burst.fill >= burst.frames) {
+                        int64_t wait = burst_wait(audio);
+                        if (wait > 0) {
+                            wait_for_dbus(dbus_conn, -1, wait / 1000 + 1);
+                            continue;
+                        }
+                        flush_burst(audio);
+                    }
+                    int read_result;
+                    dbus_bool_t metadata_updated = FALSE;
+                    if (timeshift_attached(&timeshift)) {
+                        AVDictionary *metadata = NULL;
+                        read_result = timeshift_read(&timeshift, pkt, &metadata);
+                        if (read_result == AVERROR(EAGAIN)) {
+                            // The reader wakes the loop as soon as the packet it waits for arrives.
+                            wait_for_dbus(dbus_conn, timeshift_fd(&timeshift), TIMESHIFT_WAIT);
+                            continue;
+                        }
+                        if (metadata) {
+                            av_dict_free(&ffmpegparams.metadata);
+                            ffmpegparams.metadata = metadata;
+                            metadata_updated = TRUE;
+                        }
+                    } else {
+                        read_result = av_read_frame(ffmpegparams.fmt, pkt);
+                        if (read_result >= 0 && ffmpegparams.fmt->event_flags & AVFMT_EVENT_FLAG_METADATA_UPDATED) {
                             ffmpegparams.fmt->event_flags ^= AVFMT_EVENT_FLAG_METADATA_UPDATED;
+                            metadata_updated = TRUE;
+                        }
+                    }
+                    if (read_result >= 0) {
+                        if (metadata_updated) {
+                            notify_metadata_changed(dbus_conn, &ffmpegparams);
+                            if (recording && recording_split)
+                                split_recording(stream_metadata(&ffmpegparams));
                         }
                         if (pkt->stream_index == ffmpegparams.astream) {
+                            last_dts = pkt->dts;
+                            if (recording && recorder_push(recording, pkt))
+                                tinyaudio_values.recording_dropped++;
                             if (avcodec_send_packet(ffmpegparams.cc, pkt) == 0) {
                                 while (avcodec_receive_frame(ffmpegparams.cc, frm) == 0) {
-                                    position = frm->best_effort_timestamp * frm->time_base.num / frm->time_base.den;
-                                    uint8_t *outbuf = NULL;
-                                    int out_samples = av_rescale_rnd(
-                                        swr_get_delay(ffmpegparams.swr, ffmpegparams.cc->sample_rate) + frm->nb_samples,
-                                        ffmpegparams.cc->sample_rate, ffmpegparams.cc->sample_rate, AV_ROUND_UP);
-                                    av_samples_alloc(&outbuf, NULL, CHANNELS, out_samples, AV_SAMPLE_FMT_S16, 0);
-                                    int n = swr_convert(ffmpegparams.swr, &outbuf, out_samples,
-                                                        (const uint8_t **)frm->data, frm->nb_samples);
-                                    int frames = n;
-                                    writeaudio(audio, outbuf, frames);
-                                    av_freep(&outbuf);
+                                    play_frame(audio, &ffmpegparams, frm, bursting);
+                                    if (seek_pending) {
+                                        notify_seeked(dbus_conn, player_position(&ffmpegparams));
+                                        seek_pending = FALSE;
+                                    }
                                 }
                             }
                         }
                         av_packet_unref(pkt);
                         error_count = 0;
                     } else {
-                        if (read_result != AVERROR(EOF)) {
+                        if (read_result != AVERROR_EOF) {
                             syslog(LOG_WARNING, "Unexpected stream error!");
                             error_count++;
                             if (error_count < 5) {
                                 continue;
                             }
-                        } else {
-                            // TODO: if not at the end of playlist, or looping, call openuri with a new uri and continue
+                        }
+                        error_count = 0;
+                        if (is_reconnectable(&ffmpegparams, read_result) &&
+                            !start_reconnect(audio, &ffmpegparams, last_dts)) {
+                            continue;
+                        }
+                        if (read_result == AVERROR_EOF) {
+                            // The next track goes on filling the burst, the last one leaves it to drain.
+                            burst.draining = burst.fill > 0;
+                            ffmpegparams_free(&ffmpegparams);
+                            if (player_values.loop_status == loop_track ||
+                                tracklist_next(&tracklist, wrap_tracklist()) != TRACK_NONE) {
+                                if (!open_current(&ffmpegparams)) {
+                                    burst.draining = FALSE;
+                                    continue;
+                                }
+                            }
                         }
                         ffmpegparams_free(&ffmpegparams);
                         set_stopped();
+                        notify_playback_status_changed(dbus_conn, player_values.playback_status);
                     }
                 }
                 // TODO: log an error if one occured, log when playback finished
+                save_state(&ffmpegparams);
+                stop_recording();
+                recorder_finish_all();
                 finishaudio(audio);
+                resample_free_all();
+                tap_close(&tap);
         }
     }
     return 0;
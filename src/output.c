@@ -0,0 +1,336 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+#include <libswresample/swresample.h>
+
+#include "output.h"
+
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+#define S32_MAX 2147483520.0f // the largest float below 2^31
+#define QUANTIZE_LIMIT 16777216.0f // anything further out only needs to stay clipped, and in range of an int
+#define ERROR_LIMIT 1.5f // LSB, the most rounding and dither add up to; more is clipping, which is not fed back
+
+#define BENCH_SECONDS 20
+#define BENCH_CHUNK 1152 // frames, as in an mp3 frame
+#define BENCH_LEVEL 0.25
+
+typedef int16_t v4hi __attribute__((vector_size(8)));
+
+const char *output_format_names[OUTPUT_FORMATS] = {"float", "s16", "s24", "s32"};
+const char *output_dither_names[DITHERS] = {"none", "shaped", "tpdf"};
+
+// Error feedback filter of Wannamaker's 3 tap F-weighted noise shaper: the hiss drops by up to 12 dB around 3 kHz,
+// where hearing is most sensitive, and rises towards Nyquist.
+static const float shaping[3] = {1.623f, -0.982f, 0.109f};
+_Static_assert(SAMPLE_RATE == 44100, "the noise shaping filter is designed for 44.1 kHz");
+
+static inline v4sf splat(float x) { return (v4sf){x, x, x, x}; }
+
+static inline v4sf select(v4si mask, v4sf a, v4sf b) { return (v4sf)((mask & (v4si)a) | (~mask & (v4si)b)); }
+
+static inline v4sf clamp(v4sf x, float lo, float hi) {
+    x = select(x < splat(lo), splat(lo), x);
+    return select(x > splat(hi), splat(hi), x);
+}
+
+// Rounds to the nearest integer, halves away from zero. Adding ±0.5 before truncating would be shorter, but that sum
+// is itself rounded once x needs all 24 bits of the mantissa.
+static inline v4si round_int(v4sf x) {
+    v4si t = __builtin_convertvector(x, v4si);
+    v4sf frac = x - __builtin_convertvector(t, v4sf);
+    return t - (frac >= splat(0.5f)) + (frac <= splat(-0.5f));
+}
+
+// Every lane steps its own xorshift32 generator; the difference of the two 16 bit halves of the result has a
+// triangular distribution over ±1 LSB.
+static inline v4sf tpdf(v4su *state) {
+    v4su x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return __builtin_convertvector((v4si)(x & 0xffff) - (v4si)(x >> 16), v4sf) * (1.0f / 65536);
+}
+
+void output_init(output_t *out, enum output_format format, enum output_dither dither) {
+    out->format = format;
+    out->dither = dither;
+    out->rng = (v4su){0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35};
+    output_reset(out);
+}
+
+void output_reset(output_t *out) {
+    for (int i = 0; i < 3; i++)
+        out->error[i] = splat(0);
+}
+
+// The block functions convert up to four samples. Loads come before stores and no output sample is wider than a
+// float, so converting in place never overwrites input that is still to be read.
+static inline __attribute__((always_inline)) void s16_block(const float *src, uint8_t *dst, int n, v4su *rng,
+                                                             int dither) {
+    v4sf x = splat(0);
+    memcpy(&x, src, n * sizeof(float));
+    x *= splat(S16_SCALE);
+    if (dither)
+        x += tpdf(rng);
+    v4hi y = __builtin_convertvector(round_int(clamp(x, -32768.0f, 32767.0f)), v4hi);
+    memcpy(dst, &y, n * sizeof(int16_t));
+}
+
+static void to_s16(output_t *out, float *pcm, int samples) {
+    uint8_t *dst = (uint8_t *)pcm;
+    v4su rng = out->rng;
+    int i = 0;
+    if (out->dither == DITHER_TPDF) {
+        for (; i + 4 <= samples; i += 4)
+            s16_block(pcm + i, dst + 2 * i, 4, &rng, 1);
+        if (i < samples)
+            s16_block(pcm + i, dst + 2 * i, samples - i, &rng, 1);
+    } else {
+        for (; i + 4 <= samples; i += 4)
+            s16_block(pcm + i, dst + 2 * i, 4, &rng, 0);
+        if (i < samples)
+            s16_block(pcm + i, dst + 2 * i, samples - i, &rng, 0);
+    }
+    out->rng = rng;
+}
+
+// The error of a sample feeds into the next one, so here a vector holds one frame, a lane per channel, as in the DSP.
+static void to_s16_shaped(output_t *out, float *pcm, int frames) {
+    uint8_t *dst = (uint8_t *)pcm;
+    v4su rng = out->rng;
+    v4sf e1 = out->error[0], e2 = out->error[1], e3 = out->error[2];
+    const v4sf h1 = splat(shaping[0]), h2 = splat(shaping[1]), h3 = splat(shaping[2]);
+    for (int f = 0; f < frames; f++) {
+        v4sf x = splat(0);
+        memcpy(&x, pcm + (size_t)f * CHANNELS, CHANNELS * sizeof(float));
+        v4sf v = x * splat(S16_SCALE) - (h1 * e1 + h2 * e2 + h3 * e3);
+        v4sf q = __builtin_convertvector(round_int(clamp(v + tpdf(&rng), -QUANTIZE_LIMIT, QUANTIZE_LIMIT)), v4sf);
+        e3 = e2;
+        e2 = e1;
+        e1 = clamp(q - v, -ERROR_LIMIT, ERROR_LIMIT);
+        v4hi y = __builtin_convertvector(__builtin_convertvector(clamp(q, -32768.0f, 32767.0f), v4si), v4hi);
+        memcpy(dst + (size_t)f * CHANNELS * sizeof(int16_t), &y, CHANNELS * sizeof(int16_t));
+    }
+    out->rng = rng;
+    out->error[0] = e1;
+    out->error[1] = e2;
+    out->error[2] = e3;
+}
+
+static inline void put24(uint8_t *p, int32_t v) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    p[0] = v >> 16;
+    p[1] = v >> 8;
+    p[2] = v;
+#else
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+#endif
+}
+
+static inline __attribute__((always_inline)) void s24_block(const float *src, uint8_t *dst, int n) {
+    v4sf x = splat(0);
+    memcpy(&x, src, n * sizeof(float));
+    v4si y = round_int(clamp(x * splat(S24_SCALE), -8388608.0f, 8388607.0f));
+    for (int k = 0; k < n; k++)
+        put24(dst + 3 * k, y[k]);
+}
+
+static void to_s24(float *pcm, int samples) {
+    uint8_t *dst = (uint8_t *)pcm;
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        s24_block(pcm + i, dst + 3 * i, 4);
+    if (i < samples)
+        s24_block(pcm + i, dst + 3 * i, samples - i);
+}
+
+static inline __attribute__((always_inline)) void s32_block(float *pcm, int n) {
+    v4sf x = splat(0);
+    memcpy(&x, pcm, n * sizeof(float));
+    v4si y = round_int(clamp(x * splat(S32_SCALE), -S32_SCALE, S32_MAX));
+    memcpy(pcm, &y, n * sizeof(int32_t));
+}
+
+static void to_s32(float *pcm, int samples) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        s32_block(pcm + i, 4);
+    if (i < samples)
+        s32_block(pcm + i, samples - i);
+}
+
+static inline __attribute__((always_inline)) void float_block(float *pcm, int n) {
+    v4sf x = splat(0);
+    memcpy(&x, pcm, n * sizeof(float));
+    x = clamp(x, -1.0f, 1.0f);
+    memcpy(pcm, &x, n * sizeof(float));
+}
+
+static void to_float(float *pcm, int samples) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        float_block(pcm + i, 4);
+    if (i < samples)
+        float_block(pcm + i, samples - i);
+}
+
+size_t output_convert(output_t *out, float *pcm, int frames) {
+    int samples = frames * CHANNELS;
+    switch (out->format) {
+        case OUTPUT_S16:
+            if (out->dither == DITHER_SHAPED)
+                to_s16_shaped(out, pcm, frames);
+            else
+                to_s16(out, pcm, samples);
+            break;
+        case OUTPUT_S24:
+            to_s24(pcm, samples);
+            break;
+        case OUTPUT_S32:
+            to_s32(pcm, samples);
+            break;
+        default:
+            to_float(pcm, samples);
+            break;
+    }
+    return (size_t)samples * output_sample_bytes(out->format);
+}
+
+static double sample_value(const uint8_t *p, enum output_format format) {
+    int16_t s16;
+    int32_t s32;
+    switch (format) {
+        case OUTPUT_S16:
+            memcpy(&s16, p, sizeof(s16));
+            return s16 / (double)S16_SCALE;
+        case OUTPUT_S24:
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            s32 = (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8) >> 8;
+#else
+            s32 = (int32_t)((uint32_t)p[2] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[0] << 8) >> 8;
+#endif
+            return s32 / (double)S24_SCALE;
+        case OUTPUT_S32:
+            memcpy(&s32, p, sizeof(s32));
+            return s32 / (double)S32_SCALE;
+        default:
+            return 0;
+    }
+}
+
+// Level of what a conversion added to the signal, in dB relative to full scale.
+static double error_level(const float *in, const uint8_t *out, enum output_format format, int samples) {
+    double sum = 0;
+    int bytes = output_sample_bytes(format);
+    for (int i = 0; i < samples; i++) {
+        double e = sample_value(out + (size_t)i * bytes, format) - in[i];
+        sum += e * e;
+    }
+    return 10 * log10(sum / samples);
+}
+
+// Converts the whole tone a chunk at a time, either in place through an output or, without one, with the resampler
+// to 16 bit as the player did before. Returns how many times faster than real time that runs. The chunks end up
+// scattered over work, so the error is measured with a separate conversion in one go.
+static double conversion_speed(const float *tone, float *work, int frames, output_t *out, SwrContext *swr,
+                               int16_t *s16) {
+    memcpy(work, tone, (size_t)frames * CHANNELS * sizeof(float));
+    double start = cpu_seconds();
+    for (int pos = 0; pos < frames; pos += BENCH_CHUNK) {
+        int n = frames - pos < BENCH_CHUNK ? frames - pos : BENCH_CHUNK;
+        if (out) {
+            output_convert(out, work + (size_t)pos * CHANNELS, n);
+        } else {
+            const uint8_t *in = (const uint8_t *)(tone + (size_t)pos * CHANNELS);
+            uint8_t *dst = (uint8_t *)(s16 + (size_t)pos * CHANNELS);
+            swr_convert(swr, &dst, n, &in, n);
+        }
+    }
+    return BENCH_SECONDS / (cpu_seconds() - start);
+}
+
+int output_bench() {
+    int frames = BENCH_SECONDS * SAMPLE_RATE, samples = frames * CHANNELS;
+    float *tone = av_malloc_array(samples, sizeof(float));
+    float *work = av_malloc_array(samples, sizeof(float));
+    int16_t *s16 = av_malloc_array(samples, sizeof(int16_t));
+    SwrContext *swr = NULL;
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, CHANNELS);
+    swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_S16, SAMPLE_RATE, &layout, AV_SAMPLE_FMT_FLT, SAMPLE_RATE, 0,
+                        NULL);
+    if (!tone || !work || !s16 || !swr || swr_init(swr) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        swr_free(&swr);
+        av_free(tone);
+        av_free(work);
+        av_free(s16);
+        return 1;
+    }
+    // A decaying tone, so that the quiet end shows what happens to the last bits.
+    for (int i = 0; i < frames; i++) {
+        float v = BENCH_LEVEL * exp(-10.0 * i / frames) * sin(2 * M_PI * 997 * i / SAMPLE_RATE);
+        for (int ch = 0; ch < CHANNELS; ch++)
+            tone[(size_t)i * CHANNELS + ch] = v;
+    }
+
+    printf("\n%-16s %9s %9s\n", "conversion", "speed", "error");
+    double speed = conversion_speed(tone, work, frames, NULL, swr, s16);
+    printf("%-16s %8.0fx %7.1fdB\n", "swr s16", speed, error_level(tone, (uint8_t *)s16, OUTPUT_S16, samples));
+    static const struct {
+        enum output_format format;
+        enum output_dither dither;
+    } stages[] = {{OUTPUT_S16, DITHER_NONE}, {OUTPUT_S16, DITHER_TPDF}, {OUTPUT_S16, DITHER_SHAPED},
+                  {OUTPUT_S24, DITHER_NONE}, {OUTPUT_S32, DITHER_NONE}};
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        output_t out;
+        output_init(&out, stages[i].format, stages[i].dither);
+        char name[32];
+        snprintf(name, sizeof(name), "%s %s", output_format_names[stages[i].format],
+                 stages[i].format == OUTPUT_S16 ? output_dither_names[stages[i].dither] : "");
+        speed = conversion_speed(tone, work, frames, &out, NULL, NULL);
+        memcpy(work, tone, (size_t)samples * sizeof(float));
+        output_init(&out, stages[i].format, stages[i].dither);
+        output_convert(&out, work, frames);
+        printf("%-16s %8.0fx %7.1fdB\n", name, speed, error_level(tone, (uint8_t *)work, out.format, samples));
+    }
+    swr_free(&swr);
+    av_free(tone);
+    av_free(work);
+    av_free(s16);
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_OUTPUT_H
+#define TINYAUDIO_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinyaudio.h"
+
+// Ordered by name so that names can be looked up with binsearch.
+enum output_format { OUTPUT_FLOAT, OUTPUT_S16, OUTPUT_S24, OUTPUT_S32, OUTPUT_FORMATS };
+enum output_dither { DITHER_NONE, DITHER_SHAPED, DITHER_TPDF, DITHERS };
+
+extern const char *output_format_names[OUTPUT_FORMATS];
+extern const char *output_dither_names[DITHERS];
+
+// NOTE: from the resampler on the player works on interleaved float, full scale at ±1, so that gain and filters lose
+// nothing to rounding and may go over full scale in between. This is the one place where it turns into what the sink
+// takes. Reducing to 16 bits adds triangular (TPDF) dither of ±1 LSB, which turns the rounding error of quiet passages
+// from distortion into a steady hiss about 96 dB down; shaped dither also feeds the error back through a filter that
+// moves most of that hiss to where hearing is least sensitive. 24 and 32 bit sinks get a plain rounding conversion,
+// as float carries no more than 24 bits to begin with, and float sinks get the samples without conversion. Whatever
+// is over full scale is clipped here, for float sinks too, and nowhere else on the way to the sink; the tap clips the
+// copy it hands to visualizers on its own.
+typedef struct {
+    enum output_format format;
+    enum output_dither dither;
+    v4su rng;      // xorshift32 state, one generator per lane
+    v4sf error[3]; // past quantization errors per channel lane, for noise shaping
+} output_t;
+
+void output_init(output_t *out, enum output_format format, enum output_dither dither);
+// Forgets the noise shaping history, for when the audio that follows is unrelated to what came before.
+void output_reset(output_t *out);
+// Converts frames of float audio to the sink format in place, the result starting at pcm. Returns its size in bytes.
+size_t output_convert(output_t *out, float *pcm, int frames);
+
+static inline int output_sample_bytes(enum output_format format) {
+    return format == OUTPUT_S16 ? 2 : format == OUTPUT_S24 ? 3 : 4;
+}
+
+// Prints CPU cost and added error of every conversion next to the resampler's own conversion to 16 bit, which is
+// what the player used before. Returns a process exit code.
+int output_bench();
+
+#endif
@@ -0,0 +1,513 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+
+#include "playlist.h"
+
+enum playlist_format { FORMAT_M3U, FORMAT_PLS, FORMAT_XSPF };
+
+typedef struct {
+    AVIOContext *pb;
+    unsigned char buf[4096];
+    int pos;
+    int len;
+    char *line;
+    size_t line_cap;
+} reader_t;
+
+static int reader_getc(reader_t *r) {
+    if (r->pos == r->len) {
+        r->len = avio_read(r->pb, r->buf, sizeof(r->buf));
+        r->pos = 0;
+        if (r->len <= 0) {
+            r->len = 0;
+            return EOF;
+        }
+    }
+    return r->buf[r->pos++];
+}
+
+static int reader_peek(reader_t *r) {
+    int c = reader_getc(r);
+    if (c != EOF)
+        r->pos--;
+    return c;
+}
+
+static int reader_append(reader_t *r, size_t n, char c) {
+    if (n + 1 >= r->line_cap) {
+        size_t cap = r->line_cap ? r->line_cap * 2 : 256;
+        char *line = realloc(r->line, cap);
+        if (!line)
+            return 1;
+        r->line = line;
+        r->line_cap = cap;
+    }
+    r->line[n] = c;
+    return 0;
+}
+
+// Reads the next line into r->line with the line terminator and surrounding whitespace removed. Returns NULL at the
+// end of input.
+static char *reader_getline(reader_t *r) {
+    int c = reader_getc(r);
+    if (c == EOF)
+        return NULL;
+
+    size_t n = 0;
+    while (c != EOF && c != '\n') {
+        if (c != '\r' && reader_append(r, n++, c))
+            return NULL;
+        c = reader_getc(r);
+    }
+    if (reader_append(r, n, 0))
+        return NULL;
+    while (n > 0 && isspace((unsigned char)r->line[n - 1]))
+        r->line[--n] = 0;
+
+    char *line = r->line;
+    if (strncmp(line, "\xEF\xBB\xBF", 3) == 0)
+        line += 3;
+    while (isspace((unsigned char)*line))
+        line++;
+    return line;
+}
+
+int is_playlist(const char *uri) {
+    const char *query = strpbrk(uri, "?#");
+    size_t len = query ? (size_t)(query - uri) : strlen(uri);
+    static const char *extensions[] = {".m3u", ".m3u8", ".pls", ".xspf"};
+    for (unsigned int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        size_t extlen = strlen(extensions[i]);
+        if (len > extlen && strncasecmp(uri + len - extlen, extensions[i], extlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void tracklist_reset(tracklist_t *tl) {
+    strtab_reset(&tl->strings);
+    tl->base = 0;
+    tl->len = 0;
+    free(tl->order);
+    tl->order = NULL;
+    tl->pos = 0;
+}
+
+void tracklist_free(tracklist_t *tl) {
+    strtab_free(&tl->strings);
+    free(tl->tracks);
+    free(tl->order);
+    memset(tl, 0, sizeof(*tl));
+}
+
+static track_t *tracklist_push(tracklist_t *tl) {
+    if (tl->len == tl->cap) {
+        uint32_t cap = tl->cap ? tl->cap * 2 : 256;
+        track_t *tracks = realloc(tl->tracks, cap * sizeof(track_t));
+        if (!tracks)
+            return NULL;
+        tl->tracks = tracks;
+        tl->cap = cap;
+    }
+    track_t *track = &tl->tracks[tl->len++];
+    track->location = 0;
+    track->title = 0;
+    track->duration = -1;
+    return track;
+}
+
+int tracklist_add(tracklist_t *tl, const char *location, const char *title, int32_t duration) {
+    uint32_t loc = strtab_intern(&tl->strings, location);
+    uint32_t ttl = strtab_intern(&tl->strings, title);
+    if (loc == 0 || loc == STRTAB_ERROR || ttl == STRTAB_ERROR)
+        return 1;
+    track_t *track = tracklist_push(tl);
+    if (!track)
+        return 1;
+    track->location = loc;
+    track->title = ttl;
+    track->duration = duration;
+    if (tl->order) {
+        uint32_t *order = realloc(tl->order, tl->len * sizeof(uint32_t));
+        if (!order)
+            return 1;
+        order[tl->len - 1] = tl->len - 1;
+        tl->order = order;
+    }
+    return 0;
+}
+
+static int parse_m3u(tracklist_t *tl, reader_t *r) {
+    char *line;
+    char *title = NULL;
+    int32_t duration = -1;
+    while ((line = reader_getline(r))) {
+        if (*line == 0)
+            continue;
+        if (*line == '#') {
+            // An HLS playlist lists the segments of one stream, which avformat plays.
+            if (strncmp(line, "#EXT-X-TARGETDURATION", 21) == 0 || strncmp(line, "#EXT-X-STREAM-INF", 17) == 0 ||
+                strncmp(line, "#EXT-X-MEDIA-SEQUENCE", 21) == 0) {
+                free(title);
+                return PLAYLIST_STREAM;
+            }
+            if (strncmp(line, "#EXTINF:", 8) == 0) {
+                duration = strtol(line + 8, NULL, 10);
+                char *comma = strchr(line + 8, ',');
+                free(title);
+                title = comma ? strdup(comma + 1) : NULL;
+            }
+            continue;
+        }
+        if (tracklist_add(tl, line, title, duration)) {
+            free(title);
+            return 1;
+        }
+        free(title);
+        title = NULL;
+        duration = -1;
+    }
+    free(title);
+    return 0;
+}
+
+static int parse_pls(tracklist_t *tl, reader_t *r) {
+    // NOTE: PLS entries are numbered and their keys may come in any order, so slots are reserved as numbers are
+    // seen and the ones never given a File= key are squeezed out afterwards.
+    char *line;
+    uint32_t first = tl->len;
+    while ((line = reader_getline(r))) {
+        char *eq = strchr(line, '=');
+        if (!eq)
+            continue;
+        *eq = 0;
+        char *value = eq + 1;
+        const char *keys[] = {"File", "Title", "Length"};
+        unsigned int key;
+        for (key = 0; key < sizeof(keys) / sizeof(keys[0]); key++) {
+            if (strncasecmp(line, keys[key], strlen(keys[key])) == 0)
+                break;
+        }
+        if (key == sizeof(keys) / sizeof(keys[0]))
+            continue;
+        long n = strtol(line + strlen(keys[key]), NULL, 10);
+        if (n <= 0 || n > (long)(tl->len - first) + 65536)
+            continue;
+        while (tl->len < first + n) {
+            if (!tracklist_push(tl))
+                return 1;
+        }
+        track_t *track = &tl->tracks[first + n - 1];
+        if (key == 2) {
+            track->duration = strtol(value, NULL, 10);
+        } else {
+            uint32_t offset = strtab_intern(&tl->strings, value);
+            if (offset == STRTAB_ERROR)
+                return 1;
+            if (key == 0)
+                track->location = offset;
+            else
+                track->title = offset;
+        }
+    }
+
+    uint32_t len = first;
+    for (uint32_t i = first; i < tl->len; i++) {
+        if (tl->tracks[i].location)
+            tl->tracks[len++] = tl->tracks[i];
+    }
+    tl->len = len;
+    return 0;
+}
+
+static void xml_unescape(char *s) {
+    static const struct {
+        const char *entity;
+        char c;
+    } entities[] = {{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+    char *out = s;
+    while (*s) {
+        if (*s == '&') {
+            unsigned int i;
+            for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+                size_t len = strlen(entities[i].entity);
+                if (strncmp(s, entities[i].entity, len) == 0) {
+                    *out++ = entities[i].c;
+                    s += len;
+                    break;
+                }
+            }
+            if (i < sizeof(entities) / sizeof(entities[0]))
+                continue;
+        }
+        *out++ = *s++;
+    }
+    *out = 0;
+}
+
+// XSPF locations are URIs. FFmpeg does not percent-decode file: URLs, so local ones are turned into plain paths.
+static void file_uri_to_path(char *s) {
+    if (strncmp(s, "file://", 7) != 0)
+        return;
+    char *in = s + 7, *out = s;
+    while (*in) {
+        if (in[0] == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+            char hex[3] = {in[1], in[2], 0};
+            *out++ = strtol(hex, NULL, 16);
+            in += 3;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = 0;
+}
+
+static int parse_xspf(tracklist_t *tl, reader_t *r) {
+    // NOTE: a minimal streaming scanner rather than an XML parser: only the text of <location>, <title> and
+    // <duration> inside <track> is looked at, everything else is skipped without being buffered.
+    enum { FIELD_NONE, FIELD_LOCATION, FIELD_TITLE, FIELD_DURATION } field = FIELD_NONE;
+    int in_track = 0;
+    char tag[16];
+    track_t *track = NULL;
+    int c;
+    size_t n = 0;
+
+    while ((c = reader_getc(r)) != EOF) {
+        if (c != '<') {
+            if (field != FIELD_NONE && reader_append(r, n++, c))
+                return 1;
+            continue;
+        }
+
+        size_t taglen = 0;
+        while ((c = reader_getc(r)) != EOF && c != '>' && !isspace(c)) {
+            if (taglen < sizeof(tag) - 1)
+                tag[taglen++] = c;
+        }
+        tag[taglen] = 0;
+        while (c != EOF && c != '>')
+            c = reader_getc(r);
+
+        if (strcmp(tag, "track") == 0) {
+            in_track = 1;
+            track = tracklist_push(tl);
+            if (!track)
+                return 1;
+        } else if (strcmp(tag, "/track") == 0) {
+            in_track = 0;
+            if (track && !track->location)
+                tl->len--;
+            track = NULL;
+        } else if (in_track && field == FIELD_NONE && tag[0] != '/') {
+            if (strcmp(tag, "location") == 0)
+                field = FIELD_LOCATION;
+            else if (strcmp(tag, "title") == 0)
+                field = FIELD_TITLE;
+            else if (strcmp(tag, "duration") == 0)
+                field = FIELD_DURATION;
+            n = 0;
+        } else if (field != FIELD_NONE && tag[0] == '/') {
+            if (reader_append(r, n, 0))
+                return 1;
+            xml_unescape(r->line);
+            if (field == FIELD_DURATION) {
+                track->duration = strtol(r->line, NULL, 10) / 1000;
+            } else {
+                if (field == FIELD_LOCATION)
+                    file_uri_to_path(r->line);
+                uint32_t offset = strtab_intern(&tl->strings, r->line);
+                if (offset == STRTAB_ERROR)
+                    return 1;
+                if (field == FIELD_LOCATION && !track->location)
+                    track->location = offset;
+                else if (field == FIELD_TITLE)
+                    track->title = offset;
+            }
+            field = FIELD_NONE;
+        }
+    }
+    if (track && !track->location)
+        tl->len--;
+    return 0;
+}
+
+static enum playlist_format detect_format(const char *uri, reader_t *r) {
+    int c;
+    while ((c = reader_peek(r)) != EOF && (isspace(c) || c == 0xEF || c == 0xBB || c == 0xBF))
+        reader_getc(r);
+    if (c == '[')
+        return FORMAT_PLS;
+    if (c == '<')
+        return FORMAT_XSPF;
+    if (c == '#')
+        return FORMAT_M3U;
+
+    const char *query = strpbrk(uri, "?#");
+    size_t len = query ? (size_t)(query - uri) : strlen(uri);
+    if (len > 4 && strncasecmp(uri + len - 4, ".pls", 4) == 0)
+        return FORMAT_PLS;
+    if (len > 5 && strncasecmp(uri + len - 5, ".xspf", 5) == 0)
+        return FORMAT_XSPF;
+    return FORMAT_M3U;
+}
+
+int tracklist_load(tracklist_t *tl, const char *uri) {
+    reader_t r = {0};
+    if (avio_open(&r.pb, uri, AVIO_FLAG_READ) < 0) {
+        syslog(LOG_ERR, "Failed to open playlist\n");
+        return 1;
+    }
+
+    tracklist_reset(tl);
+    const char *slash = strrchr(uri, '/');
+    if (slash) {
+        char *base = strndup(uri, slash - uri + 1);
+        tl->base = base ? strtab_intern(&tl->strings, base) : 0;
+        free(base);
+    }
+
+    int result;
+    switch (detect_format(uri, &r)) {
+        case FORMAT_PLS:
+            result = parse_pls(tl, &r);
+            break;
+        case FORMAT_XSPF:
+            result = parse_xspf(tl, &r);
+            break;
+        default:
+            result = parse_m3u(tl, &r);
+            break;
+    }
+    free(r.line);
+    avio_closep(&r.pb);
+
+    if (result == PLAYLIST_STREAM) {
+        tracklist_reset(tl);
+        syslog(LOG_INFO, "Playing an HLS playlist as a stream\n");
+        return PLAYLIST_STREAM;
+    }
+    if (result) {
+        syslog(LOG_ERR, "Out of memory while reading playlist\n");
+        return 1;
+    }
+    if (tl->len == 0) {
+        syslog(LOG_ERR, "Playlist is empty\n");
+        return 1;
+    }
+    syslog(LOG_INFO, "Loaded %u tracks, %u bytes of strings\n", tl->len, tl->strings.len);
+    return 0;
+}
+
+uint32_t tracklist_next(tracklist_t *tl, int wrap) {
+    if (tl->len == 0)
+        return TRACK_NONE;
+    if (tl->pos + 1 < tl->len) {
+        tl->pos++;
+    } else if (wrap) {
+        tl->pos = 0;
+    } else {
+        return TRACK_NONE;
+    }
+    return tracklist_current(tl);
+}
+
+uint32_t tracklist_previous(tracklist_t *tl, int wrap) {
+    if (tl->len == 0)
+        return TRACK_NONE;
+    if (tl->pos > 0) {
+        tl->pos--;
+    } else if (wrap) {
+        tl->pos = tl->len - 1;
+    } else {
+        return TRACK_NONE;
+    }
+    return tracklist_current(tl);
+}
+
+int tracklist_goto(tracklist_t *tl, uint32_t track) {
+    if (track >= tl->len)
+        return 1;
+    if (!tl->order) {
+        tl->pos = track;
+        return 0;
+    }
+    for (uint32_t i = 0; i < tl->len; i++) {
+        if (tl->order[i] == track) {
+            tl->pos = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void tracklist_set_shuffle(tracklist_t *tl, int shuffle) {
+    uint32_t current = tracklist_current(tl);
+    if (!shuffle) {
+        free(tl->order);
+        tl->order = NULL;
+        tl->pos = current == TRACK_NONE ? 0 : current;
+        return;
+    }
+    if (tl->order || tl->len == 0)
+        return;
+    if (current == TRACK_NONE)
+        current = 0;
+
+    tl->order = malloc(tl->len * sizeof(uint32_t));
+    if (!tl->order)
+        return;
+    for (uint32_t i = 0; i < tl->len; i++)
+        tl->order[i] = i;
+    // The current track goes first so that shuffling never interrupts it, the rest is a Fisher-Yates shuffle.
+    tl->order[0] = current;
+    tl->order[current] = 0;
+    for (uint32_t i = tl->len - 1; i > 1; i--) {
+        uint32_t j = 1 + (uint32_t)(((uint64_t)random() * i) / ((uint64_t)RAND_MAX + 1));
+        uint32_t tmp = tl->order[i];
+        tl->order[i] = tl->order[j];
+        tl->order[j] = tmp;
+    }
+    tl->pos = 0;
+}
+
+int tracklist_resolve(const tracklist_t *tl, uint32_t track, char *buf, size_t size) {
+    if (track >= tl->len)
+        return 1;
+    const char *location = tracklist_string(tl, tl->tracks[track].location);
+    const char *base = "";
+    if (location[0] != '/' && !strstr(location, "://"))
+        base = tracklist_string(tl, tl->base);
+    return snprintf(buf, size, "%s%s", base, location) >= (int)size;
+}
@@ -0,0 +1,80 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYAUDIO_PLAYLIST_H
+#define TINYAUDIO_PLAYLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strtab.h"
+
+#define TRACK_NONE UINT32_MAX
+#define PLAYLIST_STREAM 2
+
+// NOTE: a track only holds offsets into the string arena of its tracklist, so that a playlist with a hundred thousand
+// entries costs a few megabytes and no per-entry allocations. Tags are never stored here, they are read on demand.
+typedef struct {
+    uint32_t location; // relative entries are resolved against tracklist_t::base when opened
+    uint32_t title;    // title given by the playlist itself, 0 (the empty string) if none
+    int32_t duration;  // seconds, -1 if unknown
+} track_t;
+
+typedef struct {
+    strtab_t strings;
+    uint32_t base;
+    track_t *tracks;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t *order; // play order while shuffling, NULL otherwise
+    uint32_t pos;    // index into the play order
+} tracklist_t;
+
+int is_playlist(const char *uri);
+
+void tracklist_reset(tracklist_t *tl);
+void tracklist_free(tracklist_t *tl);
+int tracklist_add(tracklist_t *tl, const char *location, const char *title, int32_t duration);
+// Returns PLAYLIST_STREAM, with the tracklist empty, for playlists that make up a single stream, such as HLS.
+int tracklist_load(tracklist_t *tl, const char *uri);
+
+static inline const char *tracklist_string(const tracklist_t *tl, uint32_t offset) {
+    return strtab_get(&tl->strings, offset);
+}
+
+static inline uint32_t tracklist_at(const tracklist_t *tl, uint32_t pos) {
+    if (pos >= tl->len)
+        return TRACK_NONE;
+    return tl->order ? tl->order[pos] : pos;
+}
+
+static inline uint32_t tracklist_current(const tracklist_t *tl) { return tracklist_at(tl, tl->pos); }
+
+uint32_t tracklist_next(tracklist_t *tl, int wrap);
+uint32_t tracklist_previous(tracklist_t *tl, int wrap);
+int tracklist_goto(tracklist_t *tl, uint32_t track);
+void tracklist_set_shuffle(tracklist_t *tl, int shuffle);
+int tracklist_resolve(const tracklist_t *tl, uint32_t track, char *buf, size_t size);
+
+#endif
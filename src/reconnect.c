@@ -0,0 +1,109 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libavformat/avformat.h>
+
+#include "reconnect.h"
+
+static int interrupted(void *opaque) {
+    reconnect_t *rc = opaque;
+    return atomic_load(&rc->cancel) || (rc->interrupt.callback && rc->interrupt.callback(rc->interrupt.opaque));
+}
+
+static void *reconnect_thread(void *arg) {
+    reconnect_t *rc = arg;
+    int64_t delay = RECONNECT_MIN_DELAY;
+    for (rc->attempts = 1; rc->attempts <= RECONNECT_ATTEMPTS && !interrupted(rc); rc->attempts++) {
+        AVFormatContext *fmt = avformat_alloc_context();
+        if (fmt) {
+            fmt->interrupt_callback.callback = interrupted;
+            fmt->interrupt_callback.opaque = rc;
+            if (avformat_open_input(&fmt, rc->uri, NULL, NULL) == 0) {
+                rc->fmt = fmt;
+                break;
+            }
+        }
+        if (rc->attempts == RECONNECT_ATTEMPTS) {
+            syslog(LOG_WARNING, "Reconnect attempt %d failed\n", rc->attempts);
+            break;
+        }
+        syslog(LOG_WARNING, "Reconnect attempt %d failed, retrying in %lld ms\n", rc->attempts,
+               (long long)delay / 1000);
+        for (int64_t slept = 0; slept < delay && !interrupted(rc); slept += 50000)
+            usleep(50000);
+        delay = delay * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : delay * 2;
+    }
+    atomic_store(&rc->state, RECONNECT_DONE);
+    return NULL;
+}
+
+// The interrupt callback, if given, is chained after the cancel flag, so that whoever opened the original connection
+// can also abort its replacement.
+int reconnect_start(reconnect_t *rc, const char *uri, const AVIOInterruptCB *interrupt) {
+    if (reconnect_running(rc))
+        return 0;
+    rc->interrupt = interrupt ? *interrupt : (AVIOInterruptCB){NULL, NULL};
+    rc->uri = strdup(uri);
+    rc->fmt = NULL;
+    rc->attempts = 0;
+    atomic_store(&rc->cancel, 0);
+    atomic_store(&rc->state, RECONNECT_RUNNING);
+    if (!rc->uri || pthread_create(&rc->thread, NULL, reconnect_thread, rc) != 0) {
+        free(rc->uri);
+        rc->uri = NULL;
+        atomic_store(&rc->state, RECONNECT_IDLE);
+        return 1;
+    }
+    return 0;
+}
+
+// Returns 1 once the reconnect has finished, handing over the new connection (NULL if it failed), and 0 while it is
+// still going on.
+int reconnect_poll(reconnect_t *rc, AVFormatContext **fmt) {
+    if (atomic_load(&rc->state) != RECONNECT_DONE)
+        return 0;
+    pthread_join(rc->thread, NULL);
+    *fmt = rc->fmt;
+    rc->fmt = NULL;
+    free(rc->uri);
+    rc->uri = NULL;
+    atomic_store(&rc->state, RECONNECT_IDLE);
+    return 1;
+}
+
+void reconnect_cancel(reconnect_t *rc) {
+    if (!reconnect_running(rc))
+        return;
+    atomic_store(&rc->cancel, 1);
+    pthread_join(rc->thread, NULL);
+    avformat_close_input(&rc->fmt);
+    free(rc->uri);
+    rc->uri = NULL;
+    atomic_store(&rc->state, RECONNECT_IDLE);
+}
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYAUDIO_RECONNECT_H
+#define TINYAUDIO_RECONNECT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+#define RECONNECT_ATTEMPTS 10
+#define RECONNECT_MIN_DELAY 250000  // usec
+#define RECONNECT_MAX_DELAY 8000000 // usec
+
+enum reconnect_state_t { RECONNECT_IDLE, RECONNECT_RUNNING, RECONNECT_DONE };
+
+// Reopens a dropped network stream on a background thread, waiting exponentially longer between failed attempts,
+// so that the main loop can keep serving D-Bus while the sink plays out what it has buffered.
+typedef struct {
+    pthread_t thread;
+    atomic_int state;
+    atomic_int cancel;
+    char *uri;
+    AVFormatContext *fmt; // the new connection, NULL if every attempt failed
+    int attempts;
+    AVIOInterruptCB interrupt;
+} reconnect_t;
+
+int reconnect_start(reconnect_t *rc, const char *uri, const AVIOInterruptCB *interrupt);
+int reconnect_poll(reconnect_t *rc, AVFormatContext **fmt);
+void reconnect_cancel(reconnect_t *rc);
+
+static inline int reconnect_running(reconnect_t *rc) { return atomic_load(&rc->state) != RECONNECT_IDLE; }
+
+#endif
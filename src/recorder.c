@@ -0,0 +1,277 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "recorder.h"
+
+struct recording {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AVPacket *queue[RECORDER_QUEUE_PACKETS]; // NULL entries mark where a new file starts
+    unsigned head;
+    unsigned len;
+    size_t bytes;
+    int stopping;
+    int finished; // the writer thread is done and can be joined
+    struct recording *next; // in the list of stopped recordings
+    AVCodecParameters *par;
+    AVRational time_base;
+    char *path;
+    int parts;
+    // Only touched by the thread that pushes packets.
+    uint64_t dropped;
+    uint64_t dropped_bytes;
+};
+
+// The first part is written to path itself, later ones get -2, -3, ... before the extension.
+static void part_name(const recording_t *rec, char *buf, size_t size) {
+    if (rec->parts == 1) {
+        snprintf(buf, size, "%s", rec->path);
+        return;
+    }
+    const char *slash = strrchr(rec->path, '/');
+    const char *dot = strrchr(rec->path, '.');
+    if (!dot || (slash && dot < slash))
+        dot = rec->path + strlen(rec->path);
+    snprintf(buf, size, "%.*s-%d%s", (int)(dot - rec->path), rec->path, rec->parts, dot);
+}
+
+static void close_output(AVFormatContext **out) {
+    if (!*out)
+        return;
+    av_write_trailer(*out);
+    if (!((*out)->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&(*out)->pb);
+    avformat_free_context(*out);
+    *out = NULL;
+}
+
+static AVFormatContext *open_output(recording_t *rec) {
+    char name[PATH_MAX];
+    rec->parts++;
+    part_name(rec, name, sizeof(name));
+
+    AVFormatContext *out = NULL;
+    if (avformat_alloc_output_context2(&out, NULL, NULL, name) < 0)
+        return NULL;
+    AVStream *stream = avformat_new_stream(out, NULL);
+    if (!stream || avcodec_parameters_copy(stream->codecpar, rec->par) < 0)
+        goto fail;
+    stream->codecpar->codec_tag = 0;
+    stream->time_base = rec->time_base;
+    if (!(out->oformat->flags & AVFMT_NOFILE) && avio_open(&out->pb, name, AVIO_FLAG_WRITE) < 0)
+        goto fail;
+    if (avformat_write_header(out, NULL) < 0) {
+        avio_closep(&out->pb);
+        goto fail;
+    }
+    syslog(LOG_INFO, "Recording to %s\n", name);
+    return out;
+
+fail:
+    syslog(LOG_ERR, "Failed to create recording %s\n", name);
+    avformat_free_context(out);
+    return NULL;
+}
+
+static void *writer_thread(void *arg) {
+    recording_t *rec = arg;
+    AVFormatContext *out = NULL;
+    int failed = 0;
+    // Every file starts at 0, and timestamps going backwards, as after a reconnect, continue from the last packet.
+    int64_t offset = AV_NOPTS_VALUE, next_dts = 0;
+
+    pthread_mutex_lock(&rec->lock);
+    for (;;) {
+        while (!rec->len && !rec->stopping)
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        if (!rec->len)
+            break;
+        AVPacket *pkt = rec->queue[rec->head];
+        rec->head = (rec->head + 1) % RECORDER_QUEUE_PACKETS;
+        rec->len--;
+        if (pkt)
+            rec->bytes -= pkt->size;
+        pthread_mutex_unlock(&rec->lock);
+
+        if (!pkt) {
+            close_output(&out);
+            failed = 0;
+            offset = AV_NOPTS_VALUE;
+            next_dts = 0;
+        } else {
+            if (!out && !failed && !(out = open_output(rec)))
+                failed = 1;
+            if (out) {
+                if (pkt->dts == AV_NOPTS_VALUE)
+                    pkt->dts = pkt->pts;
+                if (pkt->dts != AV_NOPTS_VALUE) {
+                    if (offset == AV_NOPTS_VALUE || pkt->dts + offset < next_dts)
+                        offset = next_dts - pkt->dts;
+                    if (pkt->pts != AV_NOPTS_VALUE)
+                        pkt->pts += offset;
+                    pkt->dts += offset;
+                    next_dts = pkt->dts + (pkt->duration > 0 ? pkt->duration : 1);
+                }
+                pkt->stream_index = 0;
+                av_packet_rescale_ts(pkt, rec->time_base, out->streams[0]->time_base);
+                if (av_interleaved_write_frame(out, pkt) < 0) {
+                    syslog(LOG_ERR, "Failed to write to the recording, stopping it\n");
+                    close_output(&out);
+                    failed = 1;
+                }
+            }
+            av_packet_free(&pkt);
+        }
+        pthread_mutex_lock(&rec->lock);
+    }
+    pthread_mutex_unlock(&rec->lock);
+    close_output(&out);
+
+    pthread_mutex_lock(&rec->lock);
+    rec->finished = 1;
+    pthread_mutex_unlock(&rec->lock);
+    return NULL;
+}
+
+// Stopped recordings whose writers have not been joined yet. Only the thread that starts and stops recordings uses it.
+static recording_t *stopped;
+
+static void join_writer(recording_t *rec) {
+    pthread_join(rec->thread, NULL);
+    pthread_mutex_destroy(&rec->lock);
+    pthread_cond_destroy(&rec->cond);
+    avcodec_parameters_free(&rec->par);
+    free(rec->path);
+    free(rec);
+}
+
+// Joins the writers that are done, or all of them if wait is set.
+static void reap_stopped(int wait) {
+    for (recording_t **p = &stopped; *p;) {
+        recording_t *rec = *p;
+        pthread_mutex_lock(&rec->lock);
+        int finished = rec->finished;
+        pthread_mutex_unlock(&rec->lock);
+        if (finished || wait) {
+            *p = rec->next;
+            join_writer(rec);
+        } else {
+            p = &rec->next;
+        }
+    }
+}
+
+recording_t *recorder_start(const char *path, const AVStream *stream, const char **error) {
+    const AVOutputFormat *format = av_guess_format(NULL, path, NULL);
+    if (!format) {
+        *error = "Unknown container, the path needs an extension such as .mka, .mp3 or .aac";
+        return NULL;
+    }
+    if (avformat_query_codec(format, stream->codecpar->codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+        *error = "The container cannot hold the codec of the stream";
+        return NULL;
+    }
+
+    recording_t *rec = calloc(1, sizeof(*rec));
+    if (!rec || !(rec->path = strdup(path)) || !(rec->par = avcodec_parameters_alloc()) ||
+        avcodec_parameters_copy(rec->par, stream->codecpar) < 0)
+        goto fail;
+    rec->time_base = stream->time_base;
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (pthread_create(&rec->thread, NULL, writer_thread, rec)) {
+        pthread_mutex_destroy(&rec->lock);
+        pthread_cond_destroy(&rec->cond);
+        goto fail;
+    }
+    return rec;
+
+fail:
+    if (rec) {
+        avcodec_parameters_free(&rec->par);
+        free(rec->path);
+        free(rec);
+    }
+    *error = "Failed to start recording";
+    return NULL;
+}
+
+static int enqueue(recording_t *rec, AVPacket *pkt) {
+    int queued = 0;
+    pthread_mutex_lock(&rec->lock);
+    if (rec->len < RECORDER_QUEUE_PACKETS && (!pkt || rec->bytes + pkt->size <= RECORDER_QUEUE_BYTES)) {
+        rec->queue[(rec->head + rec->len) % RECORDER_QUEUE_PACKETS] = pkt;
+        rec->len++;
+        if (pkt)
+            rec->bytes += pkt->size;
+        queued = 1;
+        pthread_cond_signal(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->lock);
+    return queued;
+}
+
+int recorder_push(recording_t *rec, const AVPacket *pkt) {
+    // A new reference to the same buffer, the packet data is not copied.
+    AVPacket *ref = av_packet_clone(pkt);
+    if (ref && enqueue(rec, ref))
+        return 0;
+    if (rec->dropped++ == 0)
+        syslog(LOG_WARNING, "Recording can't keep up, dropping packets\n");
+    rec->dropped_bytes += pkt->size;
+    av_packet_free(&ref);
+    return 1;
+}
+
+void recorder_split(recording_t *rec) {
+    if (!enqueue(rec, NULL))
+        syslog(LOG_WARNING, "Recording queue is full, not splitting\n");
+}
+
+void recorder_stop(recording_t *rec) {
+    if (rec->dropped)
+        syslog(LOG_WARNING, "Recording dropped %llu packets, %llu bytes\n", (unsigned long long)rec->dropped,
+               (unsigned long long)rec->dropped_bytes);
+    pthread_mutex_lock(&rec->lock);
+    rec->stopping = 1;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    reap_stopped(0);
+    rec->next = stopped;
+    stopped = rec;
+}
+
+void recorder_finish_all() { reap_stopped(1); }
@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_RECORDER_H
+#define TINYAUDIO_RECORDER_H
+
+#include <libavformat/avformat.h>
+
+#define RECORDER_QUEUE_PACKETS 1024
+#define RECORDER_QUEUE_BYTES (8 << 20)
+
+// Writes the compressed packets of a stream into a file as they are read, without decoding or encoding anything. A
+// writer thread does all the file I/O. When it falls behind, packets that do not fit the bounded queue are dropped
+// and counted instead of blocking the caller.
+typedef struct recording recording_t;
+
+// The container is picked from the extension of path, which must be able to hold the codec of the stream. Returns
+// NULL and sets *error on failure.
+recording_t *recorder_start(const char *path, const AVStream *stream, const char **error);
+// Returns 1 if the packet was dropped.
+int recorder_push(recording_t *rec, const AVPacket *pkt);
+// Starts a new file, numbered after the first one, from the next pushed packet on.
+void recorder_split(recording_t *rec);
+// Returns at once, the writer thread finishes writing what is queued and the trailer in the background.
+void recorder_stop(recording_t *rec);
+// Waits for the writers of all stopped recordings to finish their files, for before the process exits.
+void recorder_finish_all();
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+
+#include "resample.h"
+#include "tinyaudio.h"
+
+#define RESAMPLE_CACHE_SIZE 4
+
+#define BENCH_SECONDS 20
+#define BENCH_CHUNK 1152 // samples per channel in an mp3 frame
+#define TONE_SECONDS 2
+#define TONE_MARGIN 4096 // output samples ignored at each end of a tone, where the filters are still settling
+#define TONE_LEVEL 0.5
+
+const char *resample_profile_names[RESAMPLE_PROFILES] = {"default", "fast", "hq"};
+
+typedef struct {
+    SwrContext *swr;
+    enum resample_profile profile;
+    enum AVSampleFormat out_fmt;
+    enum AVSampleFormat in_fmt;
+    int in_channels;
+    int in_rate;
+    uint64_t last_used;
+} cache_entry_t;
+
+static cache_entry_t cache[RESAMPLE_CACHE_SIZE];
+static uint64_t cache_clock;
+
+int resample_profile_from_name(const char *name) { return binsearch(name, resample_profile_names, RESAMPLE_PROFILES); }
+
+static int configure(SwrContext *swr, enum resample_profile profile, int soxr) {
+    switch (profile) {
+        case RESAMPLE_FAST:
+            // 8 taps with linear interpolation between 64 phases: a tenth of the default's work per sample
+            av_opt_set_int(swr, "filter_size", 8, 0);
+            av_opt_set_int(swr, "phase_shift", 6, 0);
+            av_opt_set_int(swr, "linear_interp", 1, 0);
+            av_opt_set_double(swr, "cutoff", 0.9, 0);
+            break;
+        case RESAMPLE_HQ:
+            av_opt_set_sample_fmt(swr, "internal_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+            if (soxr) {
+                av_opt_set_int(swr, "resampler", SWR_ENGINE_SOXR, 0);
+                av_opt_set_int(swr, "precision", 28, 0);
+            } else {
+                av_opt_set_int(swr, "resampler", SWR_ENGINE_SWR, 0);
+                av_opt_set_int(swr, "filter_size", 128, 0);
+                av_opt_set_int(swr, "phase_shift", 12, 0);
+                av_opt_set_int(swr, "exact_rational", 1, 0);
+            }
+            break;
+        default:
+            break;
+    }
+    return swr_init(swr);
+}
+
+static SwrContext *create(enum resample_profile profile, enum AVSampleFormat out_fmt, int in_channels,
+                          enum AVSampleFormat in_fmt, int in_rate) {
+    AVChannelLayout out_layout, in_layout;
+    av_channel_layout_default(&out_layout, CHANNELS);
+    av_channel_layout_default(&in_layout, in_channels);
+    SwrContext *swr = NULL;
+    if (swr_alloc_set_opts2(&swr, &out_layout, out_fmt, SAMPLE_RATE, &in_layout, in_fmt, in_rate, 0, NULL) < 0)
+        return NULL;
+    int ret = configure(swr, profile, 1);
+    if (ret < 0 && profile == RESAMPLE_HQ) {
+        syslog(LOG_INFO, "soxr is not available, using a long filter for high quality resampling\n");
+        ret = configure(swr, profile, 0);
+    }
+    if (ret < 0) {
+        syslog(LOG_ERR, "Failed to initialize the resampler\n");
+        swr_free(&swr);
+    }
+    return swr;
+}
+
+SwrContext *resample_get(enum resample_profile profile, enum AVSampleFormat out_fmt, int in_channels,
+                         enum AVSampleFormat in_fmt, int in_rate) {
+    cache_entry_t *victim = &cache[0];
+    for (int i = 0; i < RESAMPLE_CACHE_SIZE; i++) {
+        cache_entry_t *e = &cache[i];
+        if (e->swr && e->profile == profile && e->out_fmt == out_fmt && e->in_channels == in_channels &&
+            e->in_fmt == in_fmt && e->in_rate == in_rate) {
+            // NOTE: reinitializing with unchanged parameters only drops the buffered samples and the filter state,
+            // swresample keeps the filter bank when the rates and the filter settings are the same.
+            if (swr_init(e->swr) < 0) {
+                // Replace the broken context in place rather than leave it for the next lookup to find.
+                swr_free(&e->swr);
+                victim = e;
+                break;
+            }
+            e->last_used = ++cache_clock;
+            return e->swr;
+        }
+        if (!e->swr || (victim->swr && e->last_used < victim->last_used))
+            victim = e;
+    }
+
+    swr_free(&victim->swr);
+    victim->swr = create(profile, out_fmt, in_channels, in_fmt, in_rate);
+    victim->profile = profile;
+    victim->out_fmt = out_fmt;
+    victim->in_channels = in_channels;
+    victim->in_fmt = in_fmt;
+    victim->in_rate = in_rate;
+    victim->last_used = ++cache_clock;
+    return victim->swr;
+}
+
+void resample_free_all() {
+    for (int i = 0; i < RESAMPLE_CACHE_SIZE; i++)
+        swr_free(&cache[i].swr);
+}
+
+// Fills CHANNELS planes with the same sine, like a decoder producing planar float.
+static void make_tone(float **planes, int samples, int rate, double freq) {
+    for (int i = 0; i < samples; i++)
+        planes[0][i] = TONE_LEVEL * sin(2 * M_PI * freq * i / rate);
+    for (int ch = 1; ch < CHANNELS; ch++)
+        memcpy(planes[ch], planes[0], samples * sizeof(float));
+}
+
+// Resamples a tone to interleaved float and returns the first channel in *out, including the flushed tail.
+static int resample_tone(enum resample_profile profile, int in_rate, double freq, float **out) {
+    int in_samples = TONE_SECONDS * in_rate;
+    int out_cap = av_rescale_rnd(in_samples, SAMPLE_RATE, in_rate, AV_ROUND_UP) + 2 * TONE_MARGIN;
+    float *samples = av_malloc_array((size_t)in_samples * CHANNELS, sizeof(float));
+    float *planes[CHANNELS];
+    for (int ch = 0; ch < CHANNELS; ch++)
+        planes[ch] = samples + (size_t)ch * in_samples;
+    float *interleaved = av_malloc_array((size_t)out_cap * CHANNELS, sizeof(float));
+    *out = av_malloc_array(out_cap, sizeof(float));
+
+    int n = -1;
+    SwrContext *swr = create(profile, AV_SAMPLE_FMT_FLT, CHANNELS, AV_SAMPLE_FMT_FLTP, in_rate);
+    if (swr && samples && interleaved && *out) {
+        make_tone(planes, in_samples, in_rate, freq);
+        uint8_t *dst = (uint8_t *)interleaved;
+        n = swr_convert(swr, &dst, out_cap, (const uint8_t **)planes, in_samples);
+        if (n >= 0) {
+            dst = (uint8_t *)(interleaved + (size_t)n * CHANNELS);
+            int tail = swr_convert(swr, &dst, out_cap - n, NULL, 0);
+            n += tail > 0 ? tail : 0;
+            for (int i = 0; i < n; i++)
+                (*out)[i] = interleaved[(size_t)i * CHANNELS];
+        }
+    }
+    swr_free(&swr);
+    av_free(samples);
+    av_free(interleaved);
+    return n;
+}
+
+// THD+N of a resampled tone in dB: whatever is left after subtracting the best fitting sine of the same frequency,
+// relative to that sine. With level set, returns the output level relative to the input instead, which is what is
+// left of a tone the resampler should have removed.
+static double tone_quality(enum resample_profile profile, int in_rate, double freq, int level) {
+    float *out;
+    int n = resample_tone(profile, in_rate, freq, &out) - 2 * TONE_MARGIN;
+    if (n <= 0) {
+        av_free(out);
+        return NAN;
+    }
+
+    const float *y = out + TONE_MARGIN;
+    double w = 2 * M_PI * freq / SAMPLE_RATE, s = 0, c = 0, energy = 0;
+    for (int i = 0; i < n; i++) {
+        s += y[i] * sin(w * i);
+        c += y[i] * cos(w * i);
+        energy += (double)y[i] * y[i];
+    }
+    double result;
+    if (level) {
+        result = 10 * log10(energy / n / (TONE_LEVEL * TONE_LEVEL / 2));
+    } else {
+        double a = 2 * s / n, b = 2 * c / n, residual = 0;
+        for (int i = 0; i < n; i++) {
+            double e = y[i] - a * sin(w * i) - b * cos(w * i);
+            residual += e * e;
+        }
+        result = 10 * log10(residual / (n * (a * a + b * b) / 2));
+    }
+    av_free(out);
+    return result;
+}
+
+// Measures a resampler as the player uses it: planar float stereo from the decoder to interleaved float, one mp3
+// frame at a time. Returns how many times faster than real time it runs, and how long building and resetting it
+// takes in microseconds.
+static double conversion_speed(enum resample_profile profile, int in_rate, double *build_us, double *reset_us) {
+    int total = BENCH_SECONDS * in_rate;
+    float *samples = av_malloc_array((size_t)total * CHANNELS, sizeof(float));
+    float *planes[CHANNELS];
+    for (int ch = 0; ch < CHANNELS; ch++)
+        planes[ch] = samples + (size_t)ch * total;
+    int out_cap = av_rescale_rnd(BENCH_CHUNK, SAMPLE_RATE, in_rate, AV_ROUND_UP) + 256;
+    uint8_t *outbuf = NULL;
+    av_samples_alloc(&outbuf, NULL, CHANNELS, out_cap, AV_SAMPLE_FMT_FLT, 0);
+
+    double speed = NAN;
+    double start = cpu_seconds();
+    SwrContext *swr = create(profile, AV_SAMPLE_FMT_FLT, CHANNELS, AV_SAMPLE_FMT_FLTP, in_rate);
+    *build_us = (cpu_seconds() - start) * 1e6;
+    if (swr && outbuf && samples) {
+        make_tone(planes, total, in_rate, 997);
+        start = cpu_seconds();
+        swr_init(swr);
+        *reset_us = (cpu_seconds() - start) * 1e6;
+
+        start = cpu_seconds();
+        for (int pos = 0; pos + BENCH_CHUNK <= total; pos += BENCH_CHUNK) {
+            const uint8_t *in[CHANNELS];
+            for (int ch = 0; ch < CHANNELS; ch++)
+                in[ch] = (const uint8_t *)(planes[ch] + pos);
+            swr_convert(swr, &outbuf, out_cap, in, BENCH_CHUNK);
+        }
+        speed = BENCH_SECONDS / (cpu_seconds() - start);
+    }
+    swr_free(&swr);
+    av_freep(&outbuf);
+    av_free(samples);
+    return speed;
+}
+
+int resample_bench() {
+    static const int rates[] = {22050, 32000, 48000, 96000};
+    printf("%-8s %6s %9s %9s %9s %10s %10s %9s\n", "profile", "from", "speed", "build", "reset", "thd+n 1k",
+           "thd+n high", "alias");
+    for (int p = 0; p < RESAMPLE_PROFILES; p++) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            int rate = rates[r];
+            double build_us = NAN, reset_us = NAN;
+            double speed = conversion_speed(p, rate, &build_us, &reset_us);
+            // Just below the lower of the two Nyquist frequencies, where short filters lose most.
+            double high = 0.4 * (rate < SAMPLE_RATE ? rate : SAMPLE_RATE);
+            double thdn_1k = tone_quality(p, rate, 997, 0);
+            double thdn_high = tone_quality(p, rate, high, 0);
+            printf("%-8s %6d %8.0fx %7.0fus %7.0fus %8.1fdB %8.1fdB ", resample_profile_names[p], rate, speed,
+                   build_us, reset_us, thdn_1k, thdn_high);
+            // Aliasing only happens when downsampling: a tone between both Nyquist frequencies must disappear.
+            if (rate > SAMPLE_RATE)
+                printf("%7.1fdB\n", tone_quality(p, rate, (SAMPLE_RATE + rate) / 4.0, 1));
+            else
+                printf("%9s\n", "-");
+        }
+    }
+    return 0;
+}
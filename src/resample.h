@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_RESAMPLE_H
+#define TINYAUDIO_RESAMPLE_H
+
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+
+// Ordered by name so that names can be looked up with binsearch.
+enum resample_profile { RESAMPLE_DEFAULT, RESAMPLE_FAST, RESAMPLE_HQ, RESAMPLE_PROFILES };
+
+extern const char *resample_profile_names[RESAMPLE_PROFILES];
+
+int resample_profile_from_name(const char *name);
+
+// Returns a resampler converting to SAMPLE_RATE/CHANNELS. Contexts are cached by profile and input parameters and stay
+// owned by the cache: a track with the same rate pair as an earlier one gets that track's context back, reset but with
+// its filter bank intact, so nothing is recomputed between tracks.
+SwrContext *resample_get(enum resample_profile profile, enum AVSampleFormat out_fmt, int in_channels,
+                         enum AVSampleFormat in_fmt, int in_rate);
+void resample_free_all();
+
+// Prints CPU cost and quality of every profile for common rate pairs. Returns a process exit code.
+int resample_bench();
+
+#endif
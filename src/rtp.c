@@ -0,0 +1,650 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libavutil/mathematics.h>
+#include <libavutil/random_seed.h>
+#include <libavutil/time.h>
+#include <pulse/simple.h>
+
+#include "rtp.h"
+
+#define RTP_EXTENSION_PROFILE 0x5441 // "TA"
+#define RTP_EXTENSION_WORDS 3        // presentation time and generation
+#define RTP_HEADER_SIZE (12 + 4 + 4 * RTP_EXTENSION_WORDS)
+#define RTP_PAYLOAD_SIZE (RTP_FRAMES * CHANNELS * 2)
+#define RTP_PACKET_DURATION ((int64_t)RTP_FRAMES * 1000000 / SAMPLE_RATE)
+#define SYNC_REQUEST 0x54417371 // "TAsq"
+#define SYNC_REPLY 0x54417372   // "TAsr"
+#define SYNC_REQUEST_SIZE 40
+#define SYNC_REPLY_SIZE 24
+#define SYNC_SAMPLES 16
+#define RECEIVE_LEAD 40000       // usec, how far ahead of its presentation a packet is handed to the sink
+#define RECEIVE_TOLERANCE 300    // usec of smoothed playback error left alone
+#define RECEIVE_STEP 20000       // usec of playback error corrected at once rather than a frame per packet
+#define RECEIVE_REPORT 5000000   // usec between receiver statistics in the log
+#define RECEIVE_MARK 512         // packets whose sequence number is a multiple of this have their play time logged
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static inline void put64(uint8_t *p, uint64_t v) {
+    put32(p, v >> 32);
+    put32(p + 4, v);
+}
+
+static inline uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static inline uint32_t get32(const uint8_t *p) { return (uint32_t)get16(p) << 16 | get16(p + 2); }
+static inline uint64_t get64(const uint8_t *p) { return (uint64_t)get32(p) << 32 | get32(p + 4); }
+
+// Splits host:port and resolves the host, IPv4 only.
+static int parse_address(const char *address, struct sockaddr_in *sa) {
+    const char *colon = strrchr(address, ':');
+    if (!colon || colon == address || !colon[1]) {
+        syslog(LOG_ERR, "Expected host:port, got %s\n", address);
+        return 1;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *res;
+    int err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err) {
+        syslog(LOG_ERR, "Failed to resolve %s: %s\n", address, gai_strerror(err));
+        return 1;
+    }
+    memcpy(sa, res->ai_addr, sizeof(*sa));
+    freeaddrinfo(res);
+    return 0;
+}
+
+struct rtp_sender {
+    int fd;
+    int control;
+    struct sockaddr_in dest;
+    pthread_t thread;
+    atomic_int stop;
+    pthread_mutex_t lock; // guards everything up to the delays, shared with the control thread
+    struct {
+        uint32_t id;
+        uint32_t late;
+        int64_t error;
+        int64_t jitter;
+        int64_t seen; // 0 for a free slot
+    } receivers[RTP_RECEIVERS];
+    int64_t wanted_delay;
+    int64_t late_floor; // raised whenever a receiver reports late packets
+    int64_t delay;
+    int restart;
+    uint32_t generation;
+    // Only touched by the thread that sends.
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t timestamp;
+    int64_t epoch;   // presentation time of the first frame since the timeline restarted
+    int64_t frames;  // frames sent since then
+    int16_t pending[RTP_FRAMES * CHANNELS];
+    int npending;
+};
+
+static inline int64_t next_play_at(const rtp_sender_t *s) {
+    return s->epoch + av_rescale(s->frames, 1000000, SAMPLE_RATE);
+}
+
+// Works out the delay the receivers need from their latest reports. Called with the lock held.
+static void update_delay(rtp_sender_t *s, int64_t now) {
+    int64_t wanted = s->late_floor > RTP_MIN_DELAY ? s->late_floor : RTP_MIN_DELAY;
+    for (int i = 0; i < RTP_RECEIVERS; i++) {
+        if (!s->receivers[i].seen || now - s->receivers[i].seen > RTP_RECEIVER_TIMEOUT)
+            continue;
+        // Four times the mean deviation covers all but the rarest outliers of a well behaved network.
+        int64_t need = 4 * s->receivers[i].jitter + 2 * RTP_PACKET_DURATION;
+        if (need > wanted)
+            wanted = need;
+    }
+    s->wanted_delay = wanted < RTP_MAX_DELAY ? wanted : RTP_MAX_DELAY;
+}
+
+static void update_receiver(rtp_sender_t *s, const uint8_t *req, int64_t now) {
+    uint32_t id = get32(req + 4);
+    pthread_mutex_lock(&s->lock);
+    int slot = -1;
+    for (int i = 0; i < RTP_RECEIVERS && slot < 0; i++)
+        if (s->receivers[i].seen && s->receivers[i].id == id)
+            slot = i;
+    for (int i = 0; i < RTP_RECEIVERS && slot < 0; i++)
+        if (!s->receivers[i].seen || now - s->receivers[i].seen > RTP_RECEIVER_TIMEOUT) {
+            slot = i;
+            s->receivers[i].id = id;
+            s->receivers[i].late = get32(req + 32);
+        }
+    if (slot >= 0) {
+        uint32_t late = get32(req + 32);
+        if (late != s->receivers[slot].late) {
+            int64_t raised = s->delay * 3 / 2;
+            if (raised > s->late_floor)
+                s->late_floor = raised;
+            syslog(LOG_NOTICE, "A receiver lost %u packets to lateness, raising the delay to %lld ms\n",
+                   late - s->receivers[slot].late, (long long)s->late_floor / 1000);
+        }
+        s->receivers[slot].late = late;
+        s->receivers[slot].error = (int64_t)get64(req + 16);
+        s->receivers[slot].jitter = (int64_t)get64(req + 24);
+        s->receivers[slot].seen = now;
+        update_delay(s, now);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Answers clock requests at once, so that the reply time is as close as can be to the middle of the round trip.
+static void *control_thread(void *arg) {
+    rtp_sender_t *s = arg;
+    uint8_t req[64];
+    while (!atomic_load(&s->stop)) {
+        struct pollfd pfd = {.fd = s->control, .events = POLLIN};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        struct sockaddr_in from;
+        socklen_t len = sizeof(from);
+        ssize_t n = recvfrom(s->control, req, sizeof(req), 0, (struct sockaddr *)&from, &len);
+        int64_t now = av_gettime_relative();
+        if (n != SYNC_REQUEST_SIZE || get32(req) != SYNC_REQUEST)
+            continue;
+        uint8_t reply[SYNC_REPLY_SIZE];
+        put32(reply, SYNC_REPLY);
+        memcpy(reply + 4, req + 4, 12); // receiver id and its send time
+        put64(reply + 16, now);
+        sendto(s->control, reply, sizeof(reply), 0, (struct sockaddr *)&from, len);
+        update_receiver(s, req, now);
+    }
+    return NULL;
+}
+
+rtp_sender_t *rtp_sender_open(const char *address) {
+    rtp_sender_t *s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    s->fd = s->control = -1;
+    if (parse_address(address, &s->dest))
+        goto fail;
+    s->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    s->control = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s->fd < 0 || s->control < 0)
+        goto fail_errno;
+    // Stay on the local network, and let receivers on this host hear the stream too.
+    unsigned char ttl = 1, loop = 1;
+    setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    struct sockaddr_in control = {.sin_family = AF_INET,
+                                  .sin_addr.s_addr = htonl(INADDR_ANY),
+                                  .sin_port = htons(ntohs(s->dest.sin_port) + 1)};
+    if (bind(s->control, (struct sockaddr *)&control, sizeof(control)) < 0)
+        goto fail_errno;
+
+    s->ssrc = av_get_random_seed();
+    s->seq = av_get_random_seed();
+    s->timestamp = av_get_random_seed();
+    s->delay = s->wanted_delay = RTP_MIN_DELAY;
+    s->restart = 1;
+    pthread_mutex_init(&s->lock, NULL);
+    if (pthread_create(&s->thread, NULL, control_thread, s) != 0) {
+        pthread_mutex_destroy(&s->lock);
+        goto fail;
+    }
+    return s;
+
+fail_errno:
+    syslog(LOG_ERR, "Failed to set up streaming to %s: %m\n", address);
+fail:
+    if (s->fd >= 0)
+        close(s->fd);
+    if (s->control >= 0)
+        close(s->control);
+    free(s);
+    return NULL;
+}
+
+void rtp_sender_close(rtp_sender_t *s) {
+    if (!s)
+        return;
+    atomic_store(&s->stop, 1);
+    pthread_join(s->thread, NULL);
+    pthread_mutex_destroy(&s->lock);
+    close(s->fd);
+    close(s->control);
+    free(s);
+}
+
+static void send_packet(rtp_sender_t *s) {
+    int64_t now = av_gettime_relative();
+    int marker = 0;
+    pthread_mutex_lock(&s->lock);
+    // Restart the timeline after a flush, and when the caller fell behind it, e.g. after a pause.
+    if (s->restart || next_play_at(s) < now + RTP_PACKET_DURATION) {
+        if (s->late_floor > RTP_MIN_DELAY)
+            s->late_floor -= (s->late_floor - RTP_MIN_DELAY) / 2;
+        update_delay(s, now);
+        s->delay = s->wanted_delay;
+        s->epoch = now + s->delay;
+        s->frames = 0;
+        s->restart = 0;
+        marker = 1;
+    } else if (s->wanted_delay > s->delay) {
+        // Receivers hear this as a short gap, which beats losing packets for as long as the network misbehaves.
+        s->epoch += s->wanted_delay - s->delay;
+        s->delay = s->wanted_delay;
+        marker = 1;
+    }
+    int64_t delay = s->delay;
+    uint32_t generation = s->generation;
+    pthread_mutex_unlock(&s->lock);
+
+    int64_t play_at = next_play_at(s);
+    if (play_at - delay > now)
+        av_usleep(play_at - delay - now);
+
+    uint8_t pkt[RTP_HEADER_SIZE + RTP_PAYLOAD_SIZE];
+    pkt[0] = 0x90; // version 2, with a header extension
+    pkt[1] = (marker << 7) | RTP_PAYLOAD_TYPE;
+    put16(pkt + 2, s->seq);
+    put32(pkt + 4, s->timestamp);
+    put32(pkt + 8, s->ssrc);
+    put16(pkt + 12, RTP_EXTENSION_PROFILE);
+    put16(pkt + 14, RTP_EXTENSION_WORDS);
+    put64(pkt + 16, play_at);
+    put32(pkt + 24, generation);
+    for (int i = 0; i < RTP_FRAMES * CHANNELS; i++)
+        put16(pkt + RTP_HEADER_SIZE + 2 * i, s->pending[i]);
+    if (sendto(s->fd, pkt, sizeof(pkt), 0, (struct sockaddr *)&s->dest, sizeof(s->dest)) < 0)
+        syslog(LOG_WARNING, "Failed to send an RTP packet: %m\n");
+    s->seq++;
+    s->timestamp += RTP_FRAMES;
+    s->frames += RTP_FRAMES;
+}
+
+void rtp_send(rtp_sender_t *s, const int16_t *pcm, int frames) {
+    while (frames > 0) {
+        int n = RTP_FRAMES - s->npending;
+        if (n > frames)
+            n = frames;
+        memcpy(s->pending + s->npending * CHANNELS, pcm, n * CHANNELS * sizeof(int16_t));
+        s->npending += n;
+        pcm += n * CHANNELS;
+        frames -= n;
+        if (s->npending == RTP_FRAMES) {
+            send_packet(s);
+            s->npending = 0;
+        }
+    }
+}
+
+void rtp_flush(rtp_sender_t *s) {
+    s->npending = 0;
+    pthread_mutex_lock(&s->lock);
+    s->generation++;
+    s->restart = 1;
+    pthread_mutex_unlock(&s->lock);
+}
+
+int64_t rtp_latency(rtp_sender_t *s) {
+    pthread_mutex_lock(&s->lock);
+    int restart = s->restart;
+    int64_t delay = s->wanted_delay;
+    pthread_mutex_unlock(&s->lock);
+    int64_t now = av_gettime_relative();
+    int64_t heard_at = next_play_at(s) + av_rescale(s->npending, 1000000, SAMPLE_RATE);
+    if (restart || heard_at < now)
+        return delay;
+    return heard_at - now;
+}
+
+void rtp_stats(rtp_sender_t *s, uint32_t *receivers, int64_t *skew, int64_t *delay) {
+    int64_t now = av_gettime_relative(), low = INT64_MAX, high = INT64_MIN;
+    *receivers = 0;
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < RTP_RECEIVERS; i++) {
+        if (!s->receivers[i].seen || now - s->receivers[i].seen > RTP_RECEIVER_TIMEOUT)
+            continue;
+        (*receivers)++;
+        if (s->receivers[i].error < low)
+            low = s->receivers[i].error;
+        if (s->receivers[i].error > high)
+            high = s->receivers[i].error;
+    }
+    *delay = s->delay;
+    pthread_mutex_unlock(&s->lock);
+    *skew = *receivers > 1 ? high - low : 0;
+}
+
+typedef struct {
+    int valid;
+    uint16_t seq;
+    int64_t play_at; // sender clock
+    int16_t pcm[RTP_FRAMES * CHANNELS];
+} slot_t;
+
+typedef struct {
+    int data;
+    int control;
+    uint16_t port;
+    struct sockaddr_in sender; // where clock requests go, known from the first packet on
+    int have_sender;
+    uint32_t id;
+    pa_simple *pa;
+    // The sender's clock is ours plus offset, taken from the exchange with the shortest round trip of late, which
+    // is the one least disturbed by queuing.
+    struct {
+        int64_t rtt;
+        int64_t offset;
+    } samples[SYNC_SAMPLES];
+    int nsamples;
+    int next_sample;
+    int64_t offset;
+    int64_t rtt;
+    int64_t next_sync;
+    // Jitter buffer, indexed by sequence number.
+    slot_t slots[RTP_SLOTS];
+    int buffered;
+    int started;
+    uint16_t next_seq;
+    uint32_t generation;
+    int64_t expected; // local presentation time of next_seq once known, 0 before
+    int64_t last_transit;
+    int64_t jitter; // RFC 3550 interarrival jitter, usec
+    int64_t error;  // smoothed playback error, usec, positive when late
+    uint32_t late;
+    uint32_t lost;
+} receiver_t;
+
+static volatile sig_atomic_t receiving = 1;
+
+static void stop_receiving(int sig) {
+    (void)sig;
+    receiving = 0;
+}
+
+static void clear_slots(receiver_t *r) {
+    for (int i = 0; i < RTP_SLOTS; i++)
+        r->slots[i].valid = 0;
+    r->buffered = 0;
+    r->expected = 0;
+}
+
+static void handle_packet(receiver_t *r, const uint8_t *buf, ssize_t n, int64_t now) {
+    // Version 2 with our header extension and no contributing sources.
+    if (n < RTP_HEADER_SIZE || (buf[0] & 0xdf) != 0x90 || (buf[1] & 0x7f) != RTP_PAYLOAD_TYPE ||
+        get16(buf + 12) != RTP_EXTENSION_PROFILE || get16(buf + 14) < RTP_EXTENSION_WORDS)
+        return;
+    size_t offset = 16 + 4 * (size_t)get16(buf + 14);
+    if ((size_t)n != offset + RTP_PAYLOAD_SIZE)
+        return;
+    uint16_t seq = get16(buf + 2);
+    int64_t play_at = (int64_t)get64(buf + 16);
+    uint32_t generation = get32(buf + 24);
+
+    // The marker bit flags a jump of the timeline, which says nothing about the network.
+    int64_t transit = now - play_at;
+    if (r->last_transit && !(buf[1] & 0x80)) {
+        int64_t d = transit - r->last_transit;
+        r->jitter += ((d < 0 ? -d : d) - r->jitter) / 16;
+    }
+    r->last_transit = transit;
+
+    if (r->started && (int32_t)(generation - r->generation) < 0)
+        return; // still in flight from before a flush
+    if (!r->started || generation != r->generation) {
+        clear_slots(r);
+        r->started = 1;
+        r->generation = generation;
+        r->next_seq = seq;
+    }
+    int16_t ahead = (int16_t)(seq - r->next_seq);
+    if (ahead < 0) {
+        r->late++;
+        return;
+    }
+    if (ahead >= RTP_SLOTS) {
+        // Lost track of the stream, e.g. after the sender was restarted.
+        clear_slots(r);
+        r->next_seq = seq;
+    }
+    slot_t *slot = &r->slots[seq % RTP_SLOTS];
+    if (slot->valid)
+        return;
+    slot->valid = 1;
+    slot->seq = seq;
+    slot->play_at = play_at;
+    for (int i = 0; i < RTP_FRAMES * CHANNELS; i++)
+        slot->pcm[i] = (int16_t)get16(buf + offset + 2 * i);
+    r->buffered++;
+}
+
+static void handle_reply(receiver_t *r, const uint8_t *buf, ssize_t n, int64_t now) {
+    if (n != SYNC_REPLY_SIZE || get32(buf) != SYNC_REPLY || get32(buf + 4) != r->id)
+        return;
+    int64_t sent = (int64_t)get64(buf + 8), remote = (int64_t)get64(buf + 16);
+    int i = r->next_sample;
+    r->samples[i].rtt = now - sent;
+    r->samples[i].offset = remote - (sent + now) / 2;
+    r->next_sample = (i + 1) % SYNC_SAMPLES;
+    if (r->nsamples < SYNC_SAMPLES)
+        r->nsamples++;
+    int best = 0;
+    for (int j = 1; j < r->nsamples; j++)
+        if (r->samples[j].rtt < r->samples[best].rtt)
+            best = j;
+    r->offset = r->samples[best].offset;
+    r->rtt = r->samples[best].rtt;
+}
+
+static void send_request(receiver_t *r, int64_t now) {
+    uint8_t req[SYNC_REQUEST_SIZE] = {0};
+    put32(req, SYNC_REQUEST);
+    put32(req + 4, r->id);
+    put64(req + 8, now);
+    put64(req + 16, r->error);
+    put64(req + 24, r->jitter);
+    put32(req + 32, r->late);
+    sendto(r->control, req, sizeof(req), 0, (struct sockaddr *)&r->sender, sizeof(r->sender));
+}
+
+// Writes a packet so that its first frame is heard at local. Large errors are corrected at once, small ones a frame per
+// packet, going by the smoothed error so that noise in the latency the sink reports does not make it hunt.
+static void write_slot(receiver_t *r, const slot_t *slot, int64_t local) {
+    int err;
+    pa_usec_t latency = pa_simple_get_latency(r->pa, &err);
+    int64_t e = av_gettime_relative() + (latency == (pa_usec_t)-1 ? 0 : (int64_t)latency) - local;
+    // A large error is corrected at once and leaves nothing for the smoothed one to catch up on.
+    r->error = e > RECEIVE_STEP || e < -RECEIVE_STEP ? 0 : r->error + (e - r->error) / 8;
+    const int16_t *pcm = slot->pcm;
+    int frames = RTP_FRAMES;
+    int shift = 0; // frames the packet is heard earlier than it would have been, negative when later
+    if (e > RECEIVE_STEP || r->error > RECEIVE_TOLERANCE) {
+        int drop = e > RECEIVE_STEP ? av_rescale(e, SAMPLE_RATE, 1000000) : 1;
+        if (drop > frames)
+            drop = frames;
+        pcm += drop * CHANNELS;
+        frames -= drop;
+        shift = drop;
+    } else if (e < -RECEIVE_STEP || r->error < -RECEIVE_TOLERANCE) {
+        int insert = e < -RECEIVE_STEP ? av_rescale(-e, SAMPLE_RATE, 1000000) : 1;
+        shift = -insert;
+        if (insert == 1) {
+            pa_simple_write(r->pa, pcm, CHANNELS * sizeof(int16_t), &err);
+        } else {
+            static const int16_t silence[RTP_FRAMES * CHANNELS];
+            for (; insert > 0; insert -= RTP_FRAMES) {
+                int len = insert < RTP_FRAMES ? insert : RTP_FRAMES;
+                pa_simple_write(r->pa, silence, len * CHANNELS * sizeof(int16_t), &err);
+            }
+        }
+    }
+    if (frames > 0)
+        pa_simple_write(r->pa, pcm, frames * CHANNELS * sizeof(int16_t), &err);
+    // Every receiver marks the same packets, and on one host they share the clock, so comparing these lines measures
+    // how far apart they are heard without trusting the errors they report.
+    if (slot->seq % RECEIVE_MARK == 0)
+        syslog(LOG_DEBUG, "Packet %u heard at %lld us\n", slot->seq,
+               (long long)(local + e - av_rescale(shift, 1000000, SAMPLE_RATE)));
+}
+
+// Hands every packet that is due to the sink and returns when the next one will be.
+static int64_t playout(receiver_t *r, int64_t now) {
+    if (!r->started || !r->nsamples)
+        return now + RTP_PACKET_DURATION;
+    while (1) {
+        slot_t *slot = &r->slots[r->next_seq % RTP_SLOTS];
+        if (slot->valid && slot->seq == r->next_seq) {
+            int64_t local = slot->play_at - r->offset;
+            if (local - now > RECEIVE_LEAD)
+                return local - RECEIVE_LEAD;
+            write_slot(r, slot, local);
+            slot->valid = 0;
+            r->buffered--;
+            r->next_seq++;
+            r->expected = local + RTP_PACKET_DURATION;
+            now = av_gettime_relative();
+            continue;
+        }
+        // A missing packet is given up on once later ones are there and its time has nearly come. The playback
+        // error correction fills the hole with silence.
+        if (!r->buffered || !r->expected)
+            return now + RTP_PACKET_DURATION;
+        if (r->expected - now > RECEIVE_LEAD / 2)
+            return r->expected - RECEIVE_LEAD / 2;
+        r->lost++;
+        r->next_seq++;
+        r->expected += RTP_PACKET_DURATION;
+    }
+}
+
+int rtp_receive(const char *address) {
+    static receiver_t r;
+    struct sockaddr_in group;
+    if (parse_address(address, &group))
+        return 1;
+    r.port = ntohs(group.sin_port);
+    r.id = av_get_random_seed();
+    r.data = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    r.control = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    // Several receivers on one host, for trying things out on the loopback interface, share the port.
+    int one = 1;
+    setsockopt(r.data, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(r.data, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    struct sockaddr_in local = {
+        .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = group.sin_port};
+    if (r.data < 0 || r.control < 0 || bind(r.data, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        syslog(LOG_ERR, "Failed to listen on %s: %m\n", address);
+        return 1;
+    }
+    if (IN_MULTICAST(ntohl(group.sin_addr.s_addr))) {
+        struct ip_mreq mreq = {.imr_multiaddr = group.sin_addr, .imr_interface.s_addr = htonl(INADDR_ANY)};
+        if (setsockopt(r.data, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            syslog(LOG_ERR, "Failed to join %s: %m\n", address);
+            return 1;
+        }
+    }
+
+    pa_sample_spec ss = {.format = PA_SAMPLE_S16NE, .channels = CHANNELS, .rate = SAMPLE_RATE};
+    // Only a little more than the lead is ever queued, so the sink must start playing long before its default
+    // prebuffer of two seconds is reached.
+    pa_buffer_attr attr = {.maxlength = (uint32_t)-1,
+                           .tlength = pa_usec_to_bytes(2 * RECEIVE_LEAD, &ss),
+                           .prebuf = pa_usec_to_bytes(RTP_PACKET_DURATION, &ss),
+                           .minreq = (uint32_t)-1,
+                           .fragsize = (uint32_t)-1};
+    r.pa = pa_simple_new(NULL, APP_NAME, PA_STREAM_PLAYBACK, NULL, "Music", &ss, NULL, &attr, NULL);
+    if (!r.pa) {
+        syslog(LOG_ERR, "Failed to connect to the sound server\n");
+        return 1;
+    }
+
+    signal(SIGINT, stop_receiving);
+    signal(SIGTERM, stop_receiving);
+    syslog(LOG_INFO, "Receiving %s\n", address);
+    int64_t next_report = av_gettime_relative() + RECEIVE_REPORT, due = 0;
+    uint8_t buf[2048];
+    while (receiving) {
+        int64_t now = av_gettime_relative();
+        int64_t wake = due < next_report ? due : next_report;
+        if (r.have_sender && r.next_sync < wake)
+            wake = r.next_sync;
+        int timeout = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+        struct pollfd pfd[2] = {{.fd = r.data, .events = POLLIN}, {.fd = r.control, .events = POLLIN}};
+        poll(pfd, 2, timeout > 100 ? 100 : timeout);
+
+        struct sockaddr_in from;
+        socklen_t len = sizeof(from);
+        ssize_t n;
+        while ((n = recvfrom(r.data, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &len)) >= 0) {
+            handle_packet(&r, buf, n, av_gettime_relative());
+            if (!r.have_sender && r.started) {
+                r.sender = from;
+                r.sender.sin_port = htons(r.port + 1);
+                r.have_sender = 1;
+            }
+            len = sizeof(from);
+        }
+        while ((n = recv(r.control, buf, sizeof(buf), MSG_DONTWAIT)) >= 0)
+            handle_reply(&r, buf, n, av_gettime_relative());
+
+        now = av_gettime_relative();
+        if (r.have_sender && now >= r.next_sync) {
+            send_request(&r, now);
+            r.next_sync = now + RTP_SYNC_INTERVAL;
+        }
+        due = playout(&r, now);
+        if (now >= next_report) {
+            syslog(LOG_INFO,
+                   "Clock offset %lld us (round trip %lld us), playback error %lld us, jitter %lld us, "
+                   "%u late, %u lost\n",
+                   (long long)r.offset, (long long)r.rtt, (long long)r.error, (long long)r.jitter, r.late, r.lost);
+            next_report = now + RECEIVE_REPORT;
+        }
+    }
+    pa_simple_free(r.pa);
+    close(r.data);
+    close(r.control);
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_RTP_H
+#define TINYAUDIO_RTP_H
+
+#include <stdint.h>
+
+#include "tinyaudio.h"
+
+#define RTP_PAYLOAD_TYPE 10      // L16, 44100 Hz, stereo (RFC 3551)
+#define RTP_FRAMES 256           // per packet, 1 KiB of payload
+#define RTP_MIN_DELAY 100000     // usec from sending a packet to playing it
+#define RTP_MAX_DELAY 2000000    // usec
+#define RTP_SLOTS 512            // jitter buffer of a receiver, ~3 s
+#define RTP_RECEIVERS 16         // tracked by a sender for the skew report
+#define RTP_SYNC_INTERVAL 250000 // usec between clock exchanges of a receiver
+#define RTP_RECEIVER_TIMEOUT 5000000
+
+_Static_assert(SAMPLE_RATE == 44100 && CHANNELS == 2, "payload type 10 is 44.1 kHz stereo");
+
+// NOTE: a sender multicasts the sink format as L16 RTP to group:port and answers clock requests on port + 1. Every
+// packet carries, in a header extension, the time it is to be heard on the sender's CLOCK_MONOTONIC. Receivers keep an
+// estimate of their offset to that clock from round trips to the sender, and play each packet at that time on their
+// own clock by dropping or inserting single frames, or whole stretches when far off. This is the presentation clock
+// all receivers share.
+//
+// The sender sends each packet `delay` ahead of its presentation time, which is the room receivers have to absorb
+// network jitter. Receivers report their jitter, late packets and playback error with every clock request; the sender
+// raises the delay right away when they need more, and lowers it only when its timeline restarts anyway. The spread of
+// the playback errors is the skew between receivers as far as they can tell; it misses their errors in estimating the
+// sender's clock, so receivers also log when they hear every RECEIVE_MARK-th packet, which measures the actual skew
+// between receivers that share a clock.
+typedef struct rtp_sender rtp_sender_t;
+
+// address is host:port, a multicast group or a single receiver. Returns NULL on failure.
+rtp_sender_t *rtp_sender_open(const char *address);
+void rtp_sender_close(rtp_sender_t *s);
+// Sends interleaved samples, blocking so as to stay no more than the delay ahead of the presentation clock.
+void rtp_send(rtp_sender_t *s, const int16_t *pcm, int frames);
+// Tells receivers to drop what they have queued and restarts the timeline with the next packet.
+void rtp_flush(rtp_sender_t *s);
+// How far ahead of presentation, in microseconds, the next sent frame would be.
+int64_t rtp_latency(rtp_sender_t *s);
+void rtp_stats(rtp_sender_t *s, uint32_t *receivers, int64_t *skew, int64_t *delay);
+
+// Plays what a sender sends to address until interrupted. Returns a process exit code.
+int rtp_receive(const char *address);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/mem.h>
+
+#include "playlist.h"
+#include "state.h"
+#include "tinyaudio.h"
+#include "xdg.h"
+
+// Playback state is not a cache that can be rebuilt, so it goes where XDG wants state to go.
+const char *state_path(const char *name) {
+    static char path[4096];
+    return xdg_path(path, sizeof(path), XDG_STATE, name);
+}
+
+// The size and modification time of a local file, -1 for anything else.
+static void file_stamp(const char *location, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    *size = *mtime = -1;
+    if (strstr(location, "://") && strncmp(location, "file:", 5) != 0)
+        return;
+    if (strncmp(location, "file:", 5) == 0)
+        location += 5;
+    if (stat(location, &st) == 0) {
+        *size = st.st_size;
+        *mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+}
+
+static FILE *open_tmp(const char *path, char *tmp, size_t size) {
+    make_parent_dirs(path);
+    snprintf(tmp, size, "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+        syslog(LOG_ERR, "Cannot write %s: %s\n", tmp, strerror(errno));
+    return f;
+}
+
+static int commit_tmp(FILE *f, const char *tmp, const char *path, int ok) {
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp, path) == 0) {
+        sync_parent_dir(path);
+        return 0;
+    }
+    syslog(LOG_ERR, "Failed to write %s\n", path);
+    unlink(tmp);
+    return 1;
+}
+
+void state_describe(state_t *state, const AVFormatContext *fmt, int astream) {
+    state_header_t *h = &state->header;
+    const AVCodecParameters *par = fmt->streams[astream]->codecpar;
+    snprintf(h->format, sizeof(h->format), "%s", fmt->iformat->name);
+    file_stamp(state->location, &h->size, &h->mtime);
+    h->duration = fmt->duration;
+    h->start_time = fmt->start_time;
+    h->bit_rate = par->bit_rate;
+    h->nb_streams = fmt->nb_streams;
+    h->stream = astream;
+    h->codec_id = par->codec_id;
+    h->sample_rate = par->sample_rate;
+    h->channels = par->ch_layout.nb_channels;
+    h->sample_fmt = par->format;
+    h->frame_size = par->frame_size;
+    h->block_align = par->block_align;
+    h->bits_per_coded_sample = par->bits_per_coded_sample;
+    h->extradata_size = par->extradata_size;
+    state->extradata = par->extradata;
+}
+
+int state_save(const char *path, const state_t *state) {
+    char tmp[4096 + 8];
+    FILE *f = open_tmp(path, tmp, sizeof(tmp));
+    if (!f)
+        return 1;
+    state_header_t header = state->header;
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    header.version = STATE_VERSION;
+    header.location_size = strlen(state->location) + 1;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(state->location, 1, header.location_size, f) == header.location_size &&
+             fwrite(state->extradata, 1, header.extradata_size, f) == header.extradata_size;
+    return commit_tmp(f, tmp, path, ok);
+}
+
+int state_load(const char *path, state_t *state) {
+    memset(state, 0, sizeof(*state));
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 1;
+    state_header_t *h = &state->header;
+    int ok = fread(h, sizeof(*h), 1, f) == 1 && memcmp(h->magic, STATE_MAGIC, sizeof(h->magic)) == 0 &&
+             h->version == STATE_VERSION && h->location_size > 1 && h->location_size <= 4096 &&
+             h->extradata_size <= 1 << 20 && h->format[sizeof(h->format) - 1] == 0;
+    if (ok) {
+        state->location = malloc(h->location_size);
+        state->extradata = av_mallocz(h->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        ok = state->location && state->extradata &&
+             fread(state->location, 1, h->location_size, f) == h->location_size &&
+             state->location[h->location_size - 1] == 0 &&
+             fread(state->extradata, 1, h->extradata_size, f) == h->extradata_size;
+    }
+    fclose(f);
+    if (!ok) {
+        syslog(LOG_WARNING, "Ignoring damaged playback state %s\n", path);
+        state_free(state);
+        return 1;
+    }
+    return 0;
+}
+
+void state_free(state_t *state) {
+    free(state->location);
+    state->location = NULL;
+    av_freep(&state->extradata);
+}
+
+int state_usable(const state_t *state, const char *location) {
+    const state_header_t *h = &state->header;
+    if (!h->format[0] || strcmp(location, state->location) != 0)
+        return 1;
+    int64_t size, mtime;
+    file_stamp(location, &size, &mtime);
+    return size != h->size || mtime != h->mtime;
+}
+
+int state_apply(const state_t *state, AVFormatContext *fmt) {
+    const state_header_t *h = &state->header;
+    if (fmt->nb_streams != h->nb_streams || h->stream < 0 || (uint32_t)h->stream >= fmt->nb_streams)
+        return 1;
+    AVCodecParameters *par = fmt->streams[h->stream]->codecpar;
+    if (par->codec_type != AVMEDIA_TYPE_AUDIO || (int)par->codec_id != h->codec_id ||
+        (par->sample_rate && par->sample_rate != h->sample_rate) ||
+        (par->ch_layout.nb_channels && par->ch_layout.nb_channels != h->channels) || h->sample_rate <= 0 ||
+        h->channels <= 0)
+        return 1;
+    if (!par->extradata_size && h->extradata_size) {
+        par->extradata = av_mallocz(h->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!par->extradata)
+            return 1;
+        memcpy(par->extradata, state->extradata, h->extradata_size);
+        par->extradata_size = h->extradata_size;
+    }
+    if (!par->ch_layout.nb_channels)
+        av_channel_layout_default(&par->ch_layout, h->channels);
+    par->sample_rate = h->sample_rate;
+    if (par->format < 0)
+        par->format = h->sample_fmt;
+    if (!par->frame_size)
+        par->frame_size = h->frame_size;
+    if (!par->block_align)
+        par->block_align = h->block_align;
+    if (!par->bits_per_coded_sample)
+        par->bits_per_coded_sample = h->bits_per_coded_sample;
+    if (!par->bit_rate)
+        par->bit_rate = h->bit_rate;
+    // Without a probe nobody works out the timings, and a missing duration would make a file look like a live stream.
+    if (fmt->duration == AV_NOPTS_VALUE)
+        fmt->duration = h->duration;
+    if (fmt->start_time == AV_NOPTS_VALUE)
+        fmt->start_time = h->start_time;
+    return 0;
+}
+
+int queue_save(const char *path, const tracklist_t *tl, uint64_t id) {
+    char tmp[4096 + 8];
+    FILE *f = open_tmp(path, tmp, sizeof(tmp));
+    if (!f)
+        return 1;
+    queue_header_t header = {0};
+    memcpy(header.magic, QUEUE_MAGIC, sizeof(header.magic));
+    header.version = STATE_VERSION;
+    header.len = tl->len;
+    header.id = id;
+    header.base = tl->base;
+    header.shuffled = tl->order != NULL;
+    header.strings_size = tl->strings.len;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(tl->tracks, sizeof(track_t), tl->len, f) == tl->len &&
+             (!tl->order || fwrite(tl->order, sizeof(uint32_t), tl->len, f) == tl->len) &&
+             fwrite(tl->strings.strings, 1, tl->strings.len, f) == tl->strings.len;
+    return commit_tmp(f, tmp, path, ok);
+}
+
+// Replaces the tracklist with the saved queue, if it is the one with the given id. The strings are interned anew, the
+// saved offsets only hold within the saved string table.
+int queue_load(const char *path, tracklist_t *tl, uint64_t id, uint32_t pos) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 1;
+    queue_header_t header;
+    track_t *tracks = NULL;
+    uint32_t *order = NULL;
+    char *strings = NULL;
+    int ok = fread(&header, sizeof(header), 1, f) == 1 &&
+             memcmp(header.magic, QUEUE_MAGIC, sizeof(header.magic)) == 0 && header.version == STATE_VERSION &&
+             header.id == id && header.len > 0 && header.strings_size > 0 && header.strings_size <= UINT32_MAX &&
+             header.base < header.strings_size;
+    if (ok) {
+        tracks = malloc(header.len * sizeof(track_t));
+        order = header.shuffled ? malloc(header.len * sizeof(uint32_t)) : NULL;
+        strings = malloc(header.strings_size);
+        ok = tracks && (order || !header.shuffled) && strings &&
+             fread(tracks, sizeof(track_t), header.len, f) == header.len &&
+             (!order || fread(order, sizeof(uint32_t), header.len, f) == header.len) &&
+             fread(strings, 1, header.strings_size, f) == header.strings_size && strings[header.strings_size - 1] == 0;
+    }
+    fclose(f);
+
+    tracklist_reset(tl);
+    if (ok)
+        tl->base = strtab_intern(&tl->strings, strings + header.base);
+    for (uint32_t i = 0; ok && i < header.len; i++) {
+        ok = tracks[i].location < header.strings_size && tracks[i].title < header.strings_size &&
+             tracklist_add(tl, strings + tracks[i].location, strings + tracks[i].title, tracks[i].duration) == 0;
+    }
+    if (ok && order) {
+        tracklist_set_shuffle(tl, 1);
+        for (uint32_t i = 0; ok && i < header.len; i++)
+            ok = order[i] < header.len;
+        if (ok && tl->order)
+            memcpy(tl->order, order, header.len * sizeof(uint32_t));
+    }
+    if (ok)
+        tl->pos = pos < tl->len ? pos : 0;
+    else
+        tracklist_reset(tl);
+    free(tracks);
+    free(order);
+    free(strings);
+    return !ok;
+}
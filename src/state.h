@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef TINYAUDIO_STATE_H
+#define TINYAUDIO_STATE_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+#include "playlist.h"
+
+#define STATE_MAGIC "TASTATE"
+#define QUEUE_MAGIC "TAQUEUE"
+#define STATE_VERSION 1
+#define STATE_FILE "state"
+#define QUEUE_FILE "queue"
+
+// NOTE: the playback state is split in two files. The state file is small and rewritten every few seconds while
+// playing, the queue file holds the tracklist, which can run into megabytes, and is only rewritten when the tracklist
+// changes. The state names the queue it goes with by its id, a state without its queue still has the location of
+// the track that was playing. Both are written to a temporary file first and renamed over the old one, so a crash
+// leaves either the old or the new file behind, never half of one.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pos; // place in the play order of the queue
+    uint64_t queue_id;
+    int64_t position; // from the start of the track, usec
+    uint32_t shuffle;
+    uint32_t loop; // index into the loop statuses
+    uint32_t location_size;
+    uint32_t extradata_size;
+    // The stream that was playing, enough to open it again without probing. The format name is empty when there was
+    // none.
+    char format[32];
+    int64_t size; // local files only, to tell whether the file changed in the meantime, -1 otherwise
+    int64_t mtime;
+    int64_t duration;
+    int64_t start_time;
+    int64_t bit_rate;
+    uint32_t nb_streams;
+    int32_t stream;
+    int32_t codec_id;
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t sample_fmt;
+    int32_t frame_size;
+    int32_t block_align;
+    int32_t bits_per_coded_sample;
+    uint32_t reserved;
+} state_header_t;
+
+typedef struct {
+    state_header_t header;
+    char *location;
+    uint8_t *extradata;
+} state_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t len;
+    uint64_t id;
+    uint32_t base;
+    uint32_t shuffled; // the play order follows the tracks
+    uint64_t strings_size;
+} queue_header_t;
+
+const char *state_path(const char *name);
+// Records the parameters of the audio stream of an opened input in the state, which borrows its extradata.
+void state_describe(state_t *state, const AVFormatContext *fmt, int astream);
+int state_save(const char *path, const state_t *state);
+int state_load(const char *path, state_t *state);
+void state_free(state_t *state);
+// Returns 0 if the saved stream parameters may be used to open location.
+int state_usable(const state_t *state, const char *location);
+// Fills in what an input opened without probing is missing from the saved stream parameters. Returns 1, and leaves
+// the input alone, if its streams do not match the saved ones.
+int state_apply(const state_t *state, AVFormatContext *fmt);
+int queue_save(const char *path, const tracklist_t *tl, uint64_t id);
+int queue_load(const char *path, tracklist_t *tl, uint64_t id, uint32_t pos);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "strtab.h"
+
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int strtab_grow_slots(strtab_t *tab) {
+    uint32_t cap = tab->slots_cap ? tab->slots_cap * 2 : 1024;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));
+    if (!slots)
+        return 1;
+    for (uint32_t i = 0; i < tab->slots_cap; i++) {
+        uint32_t offset = tab->slots[i];
+        if (offset) {
+            uint32_t slot = hash_string(tab->strings + offset) & (cap - 1);
+            while (slots[slot])
+                slot = (slot + 1) & (cap - 1);
+            slots[slot] = offset;
+        }
+    }
+    free(tab->slots);
+    tab->slots = slots;
+    tab->slots_cap = cap;
+    return 0;
+}
+
+void strtab_reset(strtab_t *tab) {
+    if (!tab->strings) {
+        tab->strings = malloc(4096);
+        tab->cap = tab->strings ? 4096 : 0;
+    }
+    if (tab->strings)
+        tab->strings[0] = 0;
+    tab->len = 1;
+    if (tab->slots)
+        memset(tab->slots, 0, tab->slots_cap * sizeof(uint32_t));
+    tab->count = 0;
+}
+
+void strtab_free(strtab_t *tab) {
+    free(tab->strings);
+    free(tab->slots);
+    memset(tab, 0, sizeof(*tab));
+}
+
+// Returns the offset of s, adding it on first use, or STRTAB_ERROR when out of memory.
+uint32_t strtab_intern(strtab_t *tab, const char *s) {
+    if (!s || !*s)
+        return 0;
+    if (!tab->strings) {
+        strtab_reset(tab);
+        if (!tab->strings)
+            return STRTAB_ERROR;
+    }
+    if (tab->count * 2 >= tab->slots_cap && strtab_grow_slots(tab))
+        return STRTAB_ERROR;
+
+    uint32_t slot = hash_string(s) & (tab->slots_cap - 1);
+    while (tab->slots[slot]) {
+        if (strcmp(tab->strings + tab->slots[slot], s) == 0)
+            return tab->slots[slot];
+        slot = (slot + 1) & (tab->slots_cap - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    if (tab->len + len > tab->cap) {
+        size_t cap = tab->cap ? tab->cap : 4096;
+        while (tab->len + len > cap)
+            cap *= 2;
+        if (cap > UINT32_MAX)
+            return STRTAB_ERROR;
+        char *strings = realloc(tab->strings, cap);
+        if (!strings)
+            return STRTAB_ERROR;
+        tab->strings = strings;
+        tab->cap = cap;
+    }
+    uint32_t offset = tab->len;
+    memcpy(tab->strings + offset, s, len);
+    tab->len += len;
+    tab->slots[slot] = offset;
+    tab->count++;
+    return offset;
+}
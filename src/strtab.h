@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYAUDIO_STRTAB_H
+#define TINYAUDIO_STRTAB_H
+
+#include <stdint.h>
+
+#define STRTAB_ERROR UINT32_MAX
+
+// A string arena where every distinct string is stored once and referred to by its offset. Offset 0 is always the
+// empty string, which callers use to mean "missing".
+typedef struct {
+    char *strings;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t *slots; // open addressing hash of string offsets, 0 marks a free slot
+    uint32_t slots_cap;
+    uint32_t count;
+} strtab_t;
+
+void strtab_reset(strtab_t *tab);
+void strtab_free(strtab_t *tab);
+uint32_t strtab_intern(strtab_t *tab, const char *s);
+
+static inline const char *strtab_get(const strtab_t *tab, uint32_t offset) { return tab->strings + offset; }
+
+#endif
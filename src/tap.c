@@ -0,0 +1,183 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE // memfd_create
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "tap.h"
+#include "tinyaudio.h"
+
+#define ALIGN64(x) (((x) + 63) & ~(size_t)63)
+
+int tap_open(tap_t *tap, uint32_t sample_rate, uint32_t channels) {
+    if (tap_is_open(tap))
+        return 0;
+
+    float scale = 1.0f;
+    if (av_tx_init(&tap->tx, &tap->rdft, AV_TX_FLOAT_RDFT, 0, TAP_FFT_SIZE, &scale, 0) < 0) {
+        syslog(LOG_ERR, "Failed to set up the spectrum transform\n");
+        return 1;
+    }
+    tap->window = av_malloc(TAP_FFT_SIZE * sizeof(float));
+    tap->fft_in = av_malloc(TAP_FFT_SIZE * sizeof(float));
+    tap->fft_out = av_malloc(TAP_BINS * sizeof(AVComplexFloat));
+    if (!tap->window || !tap->fft_in || !tap->fft_out) {
+        tap_close(tap);
+        return 1;
+    }
+    for (int i = 0; i < TAP_FFT_SIZE; i++)
+        tap->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / TAP_FFT_SIZE);
+
+    size_t pcm_offset = ALIGN64(sizeof(tap_header_t));
+    size_t spectrum_offset = ALIGN64(pcm_offset + (size_t)TAP_RING_FRAMES * channels * sizeof(int16_t));
+    size_t size = spectrum_offset + TAP_BINS * sizeof(float);
+    int fd = memfd_create("tinyaudio-tap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    void *map = MAP_FAILED;
+    if (fd < 0 || ftruncate(fd, size) < 0 ||
+        (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to create the shared memory for the tap: %m\n");
+        if (fd >= 0)
+            close(fd);
+        tap_close(tap);
+        return 1;
+    }
+    // Clients can rely on the mapping never shrinking under them.
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    tap->fd = fd;
+    tap->size = size;
+    tap->header = map;
+    tap->pcm = (int16_t *)((uint8_t *)map + pcm_offset);
+    tap->spectrum = (float *)((uint8_t *)map + spectrum_offset);
+    tap->since_fft = 0;
+    tap->header->magic = TAP_MAGIC;
+    tap->header->version = TAP_VERSION;
+    tap->header->sample_rate = sample_rate;
+    tap->header->channels = channels;
+    tap->header->ring_frames = TAP_RING_FRAMES;
+    tap->header->fft_size = TAP_FFT_SIZE;
+    tap->header->bins = TAP_BINS;
+    tap->header->pcm_offset = pcm_offset;
+    tap->header->spectrum_offset = spectrum_offset;
+    return 0;
+}
+
+void tap_close(tap_t *tap) {
+    if (tap->header) {
+        munmap(tap->header, tap->size);
+        close(tap->fd);
+        tap->header = NULL;
+    }
+    av_tx_uninit(&tap->tx);
+    av_freep(&tap->window);
+    av_freep(&tap->fft_in);
+    av_freep(&tap->fft_out);
+}
+
+int tap_reader_fd(const tap_t *tap) {
+    // Reopening the memfd through /proc gives a descriptor that can only be mapped read-only.
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", tap->fd);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void compute_spectrum(tap_t *tap, uint64_t end) {
+    uint32_t channels = tap->header->channels;
+    float gain = 1.0f / (32768.0f * channels);
+    for (uint64_t i = 0; i < TAP_FFT_SIZE; i++) {
+        const int16_t *frame = tap->pcm + (end - TAP_FFT_SIZE + i) % TAP_RING_FRAMES * channels;
+        int sum = 0;
+        for (uint32_t ch = 0; ch < channels; ch++)
+            sum += frame[ch];
+        tap->fft_in[i] = sum * gain * tap->window[i];
+    }
+    tap->rdft(tap->tx, tap->fft_out, tap->fft_in, sizeof(float));
+
+    // The Hann window sums to N/2, so a full scale sine peaks at N/4 in its bin.
+    const float norm = (4.0f / TAP_FFT_SIZE) * (4.0f / TAP_FFT_SIZE);
+    const float *c = (const float *)tap->fft_out;
+    float *power = tap->spectrum;
+    int k = 0;
+    // Four bins at a time: square the interleaved re/im pairs of two vectors and add the even and odd lanes.
+    for (; k + 4 <= TAP_BINS; k += 4) {
+        v4sf a, b;
+        memcpy(&a, c + 2 * k, sizeof(a));
+        memcpy(&b, c + 2 * k + 4, sizeof(b));
+        a *= a;
+        b *= b;
+        v4sf p = (__builtin_shufflevector(a, b, 0, 2, 4, 6) + __builtin_shufflevector(a, b, 1, 3, 5, 7)) * norm;
+        memcpy(power + k, &p, sizeof(p));
+    }
+    for (; k < TAP_BINS; k++)
+        power[k] = (c[2 * k] * c[2 * k] + c[2 * k + 1] * c[2 * k + 1]) * norm;
+    tap->header->spectrum_frame = end;
+}
+
+// Clients get 16 bit samples, which is plenty to look at, rounded without dither.
+static void store(int16_t *dst, const float *src, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        float v = src[i] * 32768.0f;
+        dst[i] = v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (int16_t)lrintf(v);
+    }
+}
+
+void tap_write(tap_t *tap, const float *pcm, int frames, int64_t delay) {
+    tap_header_t *h = tap->header;
+    uint32_t channels = h->channels;
+    uint64_t end = atomic_load_explicit(&h->write_frames, memory_order_relaxed) + frames;
+    uint64_t pos = end - frames;
+    int64_t duration = (int64_t)frames * 1000000 / h->sample_rate;
+    if (frames > TAP_RING_FRAMES) {
+        pcm += (size_t)(frames - TAP_RING_FRAMES) * channels;
+        frames = TAP_RING_FRAMES;
+        pos = end - frames;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    atomic_fetch_add(&h->seq, 1);
+    uint32_t index = pos % TAP_RING_FRAMES;
+    uint32_t first = (uint32_t)frames < TAP_RING_FRAMES - index ? (uint32_t)frames : TAP_RING_FRAMES - index;
+    store(tap->pcm + (size_t)index * channels, pcm, (size_t)first * channels);
+    store(tap->pcm, pcm + (size_t)first * channels, (size_t)(frames - first) * channels);
+    atomic_store_explicit(&h->write_frames, end, memory_order_relaxed);
+    h->heard_at = now.tv_sec * 1000000LL + now.tv_nsec / 1000 + delay + duration;
+    tap->since_fft += frames;
+    if (tap->since_fft >= TAP_FFT_HOP && end >= TAP_FFT_SIZE) {
+        compute_spectrum(tap, end);
+        tap->since_fft = 0;
+    }
+    atomic_fetch_add(&h->seq, 1);
+}
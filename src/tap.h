@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_TAP_H
+#define TINYAUDIO_TAP_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavutil/tx.h>
+
+#define TAP_MAGIC 0x50415441 // "ATAP" in memory
+#define TAP_VERSION 1
+#define TAP_RING_FRAMES (1 << 17) // ~3 s, more than the sink buffers outside of burst mode
+#define TAP_FFT_SIZE 2048
+#define TAP_FFT_HOP 1024
+#define TAP_BINS (TAP_FFT_SIZE / 2 + 1)
+
+// NOTE: this is the layout of the shared memory handed out by the OpenTap method, followed by the PCM ring (interleaved
+// native endian int16, `channels` per frame, frame n at index n % ring_frames) and the spectrum (`bins` floats). The
+// player is the only writer and never waits for readers.
+//
+// Everything past the constant fields is guarded by seq, which is odd while the player updates it: read seq, copy what
+// is needed, and retry if seq was odd or has changed since. The spectrum is the power of a Hann windowed mono downmix
+// of the fft_size frames ending at spectrum_frame, scaled so that a full scale sine reads 1.0 in its bin. heard_at
+// tells when the sink plays frame write_frames, which is what lets a client line the data up with what is audible.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t ring_frames;
+    uint32_t fft_size;
+    uint32_t bins;
+    uint32_t pcm_offset;      // bytes from the start of the mapping
+    uint32_t spectrum_offset; // bytes from the start of the mapping
+    _Atomic uint32_t seq;
+    _Atomic uint64_t write_frames;
+    uint64_t spectrum_frame;
+    int64_t heard_at; // CLOCK_MONOTONIC, microseconds
+} tap_header_t;
+
+typedef struct {
+    int fd;
+    size_t size;
+    tap_header_t *header;
+    int16_t *pcm;
+    float *spectrum;
+    AVTXContext *tx;
+    av_tx_fn rdft;
+    float *window;
+    float *fft_in;
+    AVComplexFloat *fft_out;
+    float *power;
+    uint32_t since_fft;
+} tap_t;
+
+int tap_open(tap_t *tap, uint32_t sample_rate, uint32_t channels);
+void tap_close(tap_t *tap);
+static inline int tap_is_open(const tap_t *tap) { return tap->header != NULL; }
+// Returns a new read-only descriptor of the shared memory for a client, -1 on failure.
+int tap_reader_fd(const tap_t *tap);
+// Publishes frames that the sink starts playing delay microseconds from now.
+void tap_write(tap_t *tap, const float *pcm, int frames, int64_t delay);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE // O_TMPFILE, mkostemp
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timeshift.h"
+#include "xdg.h"
+
+static inline timeshift_packet_t *packet_at(const timeshift_t *ts, uint32_t i) {
+    return &ts->packets[(ts->first + i) % ts->cap];
+}
+
+void timeshift_init(timeshift_t *ts) {
+    memset(ts, 0, sizeof(*ts));
+    pthread_mutex_init(&ts->lock, NULL);
+    ts->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ts->fd = -1;
+}
+
+// Wakes the player if it is waiting for the reader. Called with the lock held.
+static void wake(timeshift_t *ts) {
+    if (ts->waiting) {
+        ts->waiting = 0;
+        eventfd_write(ts->wake, 1);
+    }
+}
+
+int timeshift_interrupted(void *opaque) { return atomic_load(&((timeshift_t *)opaque)->stop); }
+
+static int open_spill_file(timeshift_t *ts) {
+    char path[4096];
+    xdg_path(path, sizeof(path), XDG_CACHE, "timeshift-XXXXXX");
+    make_parent_dirs(path);
+
+    char *name = strrchr(path, '/'); // O_TMPFILE takes the directory
+    *name = 0;
+    ts->fd = open(path, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    *name = '/';
+    if (ts->fd < 0) {
+        // The file system does not support O_TMPFILE
+        ts->fd = mkostemp(path, O_CLOEXEC);
+        if (ts->fd >= 0)
+            unlink(path);
+    }
+    if (ts->fd < 0) {
+        syslog(LOG_WARNING, "Failed to create the timeshift spill file, keeping only what fits in memory: %m\n");
+        ts->spill_failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Reads or writes bytes of the packet data stream in the spill file, which holds the stream modulo its size.
+static int spill_io(int fd, uint8_t *data, int64_t offset, size_t size, int write) {
+    while (size > 0) {
+        int64_t pos = offset % TIMESHIFT_DISK;
+        size_t n = size < (size_t)(TIMESHIFT_DISK - pos) ? size : (size_t)(TIMESHIFT_DISK - pos);
+        ssize_t r = write ? pwrite(fd, data, n, pos) : pread(fd, data, n, pos);
+        if (r <= 0)
+            return 1;
+        data += r;
+        offset += r;
+        size -= r;
+    }
+    return 0;
+}
+
+static void memory_io(timeshift_t *ts, uint8_t *data, int64_t offset, size_t size, int write) {
+    while (size > 0) {
+        int64_t pos = offset % TIMESHIFT_MEMORY;
+        size_t n = size < (size_t)(TIMESHIFT_MEMORY - pos) ? size : (size_t)(TIMESHIFT_MEMORY - pos);
+        if (write)
+            memcpy(ts->memory + pos, data, n);
+        else
+            memcpy(data, ts->memory + pos, n);
+        data += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+// Copies the memory that is about to be overwritten, up to offset, to the spill file.
+static int spill(timeshift_t *ts, int64_t offset) {
+    while (ts->spilled < offset) {
+        int64_t pos = ts->spilled % TIMESHIFT_MEMORY;
+        size_t n = offset - ts->spilled < TIMESHIFT_MEMORY - pos ? offset - ts->spilled : TIMESHIFT_MEMORY - pos;
+        if (spill_io(ts->fd, ts->memory + pos, ts->spilled, n, 1))
+            return 1;
+        ts->spilled += n;
+    }
+    return 0;
+}
+
+static void drop_oldest(timeshift_t *ts) {
+    timeshift_packet_t *p = packet_at(ts, 0);
+    // The metadata stays in effect for the packets that follow.
+    if (p->metadata && ts->count > 1 && !packet_at(ts, 1)->metadata)
+        packet_at(ts, 1)->metadata = p->metadata;
+    else
+        av_dict_free(&p->metadata);
+    p->metadata = NULL;
+    ts->first = (ts->first + 1) % ts->cap;
+    ts->count--;
+    if (ts->cursor)
+        ts->cursor--;
+}
+
+static void drop_outside(timeshift_t *ts, int64_t end, int64_t limit) {
+    while (ts->count && (end - packet_at(ts, 0)->offset > limit || ts->count == TIMESHIFT_PACKETS))
+        drop_oldest(ts);
+}
+
+static int grow(timeshift_t *ts) {
+    uint32_t cap = ts->cap ? ts->cap * 2 : 1024;
+    if (cap > TIMESHIFT_PACKETS)
+        cap = TIMESHIFT_PACKETS;
+    timeshift_packet_t *packets = malloc(cap * sizeof(*packets));
+    if (!packets)
+        return 1;
+    for (uint32_t i = 0; i < ts->count; i++)
+        packets[i] = *packet_at(ts, i);
+    free(ts->packets);
+    ts->packets = packets;
+    ts->cap = cap;
+    ts->first = 0;
+    return 0;
+}
+
+// The duration of a packet in usec. Packets without one count as long as a frame of the codec, or, when the frame size
+// is not known either, as long as the previous packet, measured by how far the timestamps moved since.
+static int64_t packet_duration(timeshift_t *ts, const AVPacket *pkt) {
+    if (pkt->duration > 0) {
+        ts->last_duration = av_rescale_q(pkt->duration, ts->time_base, AV_TIME_BASE_Q);
+    } else if (ts->default_duration > 0) {
+        ts->last_duration = ts->default_duration;
+    } else if (pkt->pts != AV_NOPTS_VALUE && ts->last_pts != AV_NOPTS_VALUE && pkt->pts > ts->last_pts) {
+        ts->last_duration = av_rescale_q(pkt->pts - ts->last_pts, ts->time_base, AV_TIME_BASE_Q);
+    }
+    if (pkt->pts != AV_NOPTS_VALUE)
+        ts->last_pts = pkt->pts;
+    return ts->last_duration;
+}
+
+static void append(timeshift_t *ts, const AVPacket *pkt) {
+    if (pkt->size <= 0 || pkt->size > TIMESHIFT_MEMORY)
+        return;
+    int64_t end = ts->written + pkt->size;
+    if (end > TIMESHIFT_MEMORY && ts->fd < 0 && !ts->spill_failed)
+        open_spill_file(ts);
+    int64_t limit = ts->spill_failed ? TIMESHIFT_MEMORY : TIMESHIFT_DISK;
+
+    // Packets are dropped before their place in the spill file is reused, so a concurrent timeshift_read never sees
+    // half overwritten data.
+    pthread_mutex_lock(&ts->lock);
+    drop_outside(ts, end, limit);
+    int full = ts->count == ts->cap && grow(ts);
+    pthread_mutex_unlock(&ts->lock);
+    if (full)
+        return;
+
+    if (!ts->spill_failed && end - TIMESHIFT_MEMORY > ts->spilled && spill(ts, end - TIMESHIFT_MEMORY)) {
+        syslog(LOG_WARNING, "Failed to write the timeshift spill file, keeping only what fits in memory: %m\n");
+        ts->spill_failed = 1;
+    }
+
+    pthread_mutex_lock(&ts->lock);
+    if (ts->spill_failed)
+        drop_outside(ts, end, TIMESHIFT_MEMORY);
+    memory_io(ts, pkt->data, ts->written, pkt->size, 1);
+    timeshift_packet_t *p = packet_at(ts, ts->count++);
+    p->offset = ts->written;
+    p->time = ts->end_time;
+    p->pts = pkt->pts;
+    p->dts = pkt->dts;
+    p->duration = pkt->duration;
+    p->size = pkt->size;
+    p->flags = pkt->flags;
+    p->metadata = ts->pending;
+    ts->pending = NULL;
+    ts->end_time += packet_duration(ts, pkt);
+    ts->written = end;
+    wake(ts);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+static void *reader_thread(void *arg) {
+    timeshift_t *ts = arg;
+    AVPacket *pkt = av_packet_alloc();
+    int result = pkt ? 0 : AVERROR(ENOMEM);
+    while (result >= 0 && !atomic_load(&ts->stop)) {
+        result = av_read_frame(ts->fmt, pkt);
+        if (result < 0)
+            break;
+        if (ts->fmt->event_flags & AVFMT_EVENT_FLAG_METADATA_UPDATED) {
+            ts->fmt->event_flags &= ~AVFMT_EVENT_FLAG_METADATA_UPDATED;
+            av_dict_free(&ts->pending);
+            av_dict_copy(&ts->pending, ts->fmt->metadata, 0);
+        }
+        if (pkt->stream_index == ts->astream)
+            append(ts, pkt);
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+
+    pthread_mutex_lock(&ts->lock);
+    ts->error = result < 0 ? result : AVERROR_EXIT;
+    wake(ts);
+    pthread_mutex_unlock(&ts->lock);
+    return NULL;
+}
+
+int timeshift_attach(timeshift_t *ts, AVFormatContext *fmt, int astream) {
+    if (ts->attached)
+        return 0;
+    if (!ts->memory && !(ts->memory = malloc(TIMESHIFT_MEMORY)))
+        return 1;
+    const AVStream *stream = fmt->streams[astream];
+    ts->fmt = fmt;
+    ts->astream = astream;
+    ts->time_base = stream->time_base;
+    ts->default_duration = stream->codecpar->sample_rate > 0 ? (int64_t)stream->codecpar->frame_size * AV_TIME_BASE /
+                                                                    stream->codecpar->sample_rate
+                                                              : 0;
+    ts->last_pts = AV_NOPTS_VALUE;
+    ts->last_duration = 0;
+    ts->error = 0;
+    atomic_store(&ts->stop, 0);
+    if (pthread_create(&ts->thread, NULL, reader_thread, ts))
+        return 1;
+    ts->attached = 1;
+    return 0;
+}
+
+void timeshift_detach(timeshift_t *ts) {
+    if (!ts->attached)
+        return;
+    atomic_store(&ts->stop, 1);
+    pthread_join(ts->thread, NULL);
+    atomic_store(&ts->stop, 0);
+    ts->attached = 0;
+    ts->fmt = NULL;
+    av_dict_free(&ts->pending);
+}
+
+void timeshift_clear(timeshift_t *ts) {
+    timeshift_detach(ts);
+    while (ts->count)
+        drop_oldest(ts);
+    free(ts->packets);
+    free(ts->memory);
+    ts->packets = NULL;
+    ts->memory = NULL;
+    ts->cap = ts->first = ts->cursor = 0;
+    ts->written = ts->spilled = ts->end_time = 0;
+    ts->spill_failed = 0;
+}
+
+int timeshift_read(timeshift_t *ts, AVPacket *pkt, AVDictionary **metadata) {
+    pthread_mutex_lock(&ts->lock);
+    int result = ts->error;
+    if (!result && ts->cursor == ts->count) {
+        // Whatever woke the player before has been read; the reader signals again with the next packet.
+        eventfd_t n;
+        eventfd_read(ts->wake, &n);
+        ts->waiting = 1;
+        result = AVERROR(EAGAIN);
+    } else if (!result && !(result = av_new_packet(pkt, packet_at(ts, ts->cursor)->size))) {
+        const timeshift_packet_t *p = packet_at(ts, ts->cursor++);
+        // Memory holds everything from written - TIMESHIFT_MEMORY on, the spill file everything before, so a packet
+        // that straddles the boundary is read from both. The boundary is used rather than spilled, which the reader
+        // thread advances without the lock and which is never below it.
+        int64_t boundary = ts->written - TIMESHIFT_MEMORY;
+        int64_t from_file = p->offset < boundary ? boundary - p->offset : 0;
+        if (from_file > p->size)
+            from_file = p->size;
+        if (from_file && spill_io(ts->fd, pkt->data, p->offset, from_file, 0)) {
+            syslog(LOG_WARNING, "Failed to read the timeshift spill file: %m\n");
+            av_packet_unref(pkt);
+            result = AVERROR(EAGAIN);
+            eventfd_write(ts->wake, 1); // the packet is skipped, and the next one can be read right away
+        } else if (from_file < p->size) {
+            memory_io(ts, pkt->data + from_file, p->offset + from_file, p->size - from_file, 0);
+        }
+        pkt->pts = p->pts;
+        pkt->dts = p->dts;
+        pkt->duration = p->duration;
+        pkt->flags = p->flags;
+        pkt->stream_index = ts->astream;
+        if (p->metadata)
+            av_dict_copy(metadata, p->metadata, 0);
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return result;
+}
+
+void timeshift_seek(timeshift_t *ts, int64_t offset, AVDictionary **metadata) {
+    pthread_mutex_lock(&ts->lock);
+    if (ts->count) {
+        int64_t now = ts->cursor < ts->count ? packet_at(ts, ts->cursor)->time : ts->end_time;
+        int64_t target = now + offset;
+        if (target < packet_at(ts, 0)->time)
+            target = packet_at(ts, 0)->time;
+        uint32_t lo = 0, hi = ts->count;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (packet_at(ts, mid)->time < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        ts->cursor = lo;
+        for (int64_t i = lo < ts->count ? lo : ts->count - 1; i >= 0; i--) {
+            if (packet_at(ts, i)->metadata) {
+                av_dict_copy(metadata, packet_at(ts, i)->metadata, 0);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ts->lock);
+}
+
+void timeshift_stats(timeshift_t *ts, int64_t *delay, int64_t *window) {
+    pthread_mutex_lock(&ts->lock);
+    *delay = ts->cursor < ts->count ? ts->end_time - packet_at(ts, ts->cursor)->time : 0;
+    *window = ts->count ? ts->end_time - packet_at(ts, 0)->time : 0;
+    pthread_mutex_unlock(&ts->lock);
+}
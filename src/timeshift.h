@@ -0,0 +1,108 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_TIMESHIFT_H
+#define TINYAUDIO_TIMESHIFT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+#define TIMESHIFT_MEMORY (8 << 20)  // newest bytes kept in memory
+#define TIMESHIFT_DISK (256 << 20)  // size of the spill file and so the most that is kept at all
+#define TIMESHIFT_PACKETS (1 << 20) // ~7.5 hours of mp3 frames
+#define TIMESHIFT_WAIT 100          // ms the player waits at the live edge before looking again, unless woken earlier
+
+typedef struct {
+    int64_t offset; // into the byte stream of all packet data received
+    int64_t time;   // usec, the sum of the durations of all packets received before
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    int size;
+    int flags;
+    AVDictionary *metadata; // the stream metadata from this packet on, NULL if it did not change
+} timeshift_packet_t;
+
+// NOTE: a reader thread keeps receiving the compressed packets of a live stream into a ring while playback pauses or
+// lags behind, so that it can continue where it left off and seek within what was received. The newest
+// TIMESHIFT_MEMORY bytes of packet data are kept in memory. Older data is spilled to an unlinked file in the cache
+// directory, which is only created once memory runs out.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int wake;    // eventfd the reader signals once timeshift_read has nothing to return and something arrives
+    int waiting; // timeshift_read returned AVERROR(EAGAIN) and the reader has not signalled wake since
+    atomic_int stop;
+    int attached;
+    int error; // the av_read_frame result that ended the reader, 0 while it runs
+    AVFormatContext *fmt;
+    int astream;
+    AVRational time_base;
+    int64_t default_duration; // usec, for packets without a duration, 0 if the codec has no fixed frame size
+    int64_t last_pts;
+    int64_t last_duration; // usec
+    timeshift_packet_t *packets;
+    uint32_t cap;
+    uint32_t first; // ring index of the oldest packet
+    uint32_t count;
+    uint32_t cursor; // the next packet to play, counted from the oldest one
+    int64_t end_time;
+    uint8_t *memory;
+    int64_t written; // bytes received
+    int64_t spilled; // bytes copied to the spill file
+    int fd;
+    int spill_failed;
+    AVDictionary *pending; // metadata change waiting for the next audio packet
+} timeshift_t;
+
+void timeshift_init(timeshift_t *ts);
+// Interrupt callback for inputs that may be handed to timeshift_attach.
+int timeshift_interrupted(void *opaque);
+
+// Starts receiving the audio packets of fmt, after whatever is already buffered. fmt must not be read from anywhere
+// else until timeshift_detach.
+int timeshift_attach(timeshift_t *ts, AVFormatContext *fmt, int astream);
+// Stops the reader, keeping the buffered packets.
+void timeshift_detach(timeshift_t *ts);
+// Stops the reader and drops everything.
+void timeshift_clear(timeshift_t *ts);
+static inline int timeshift_attached(const timeshift_t *ts) { return ts->attached; }
+
+// Returns 0 with the next packet to play, and in *metadata a copy of the stream metadata if it changed with that
+// packet. Never blocks: returns AVERROR(EAGAIN) at the live edge, after which timeshift_fd becomes readable once there
+// is more to read, and the error that stopped the reader once it has stopped.
+int timeshift_read(timeshift_t *ts, AVPacket *pkt, AVDictionary **metadata);
+// For polling next to the bus while timeshift_read has nothing to return.
+static inline int timeshift_fd(const timeshift_t *ts) { return ts->wake; }
+// Moves the cursor by offset usec within the buffered window. *metadata gets a copy of the metadata at the new
+// position.
+void timeshift_seek(timeshift_t *ts, int64_t offset, AVDictionary **metadata);
+// How far, in usec, playback is behind the newest packet, and how much is buffered altogether.
+void timeshift_stats(timeshift_t *ts, int64_t *delay, int64_t *window);
+
+#endif
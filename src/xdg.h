@@ -0,0 +1,42 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TINYAUDIO_XDG_H
+#define TINYAUDIO_XDG_H
+
+#include <stddef.h>
+
+// Ordered as the table of environment variables and fallbacks in xdg.c.
+enum xdg_dir { XDG_CACHE, XDG_STATE, XDG_DIRS };
+
+// Writes where the file name of this program goes in the given XDG base directory, e.g. $XDG_CACHE_HOME/tinyaudio/name
+// or ~/.cache/tinyaudio/name when the variable is unset or empty, to path. Returns path.
+char *xdg_path(char *path, size_t size, enum xdg_dir dir, const char *name);
+// Creates the directories leading up to the file at path, ignoring those that exist or cannot be made.
+void make_parent_dirs(const char *path);
+// Flushes the directory holding the file at path, so that a rename into it survives a power loss.
+void sync_parent_dir(const char *path);
+
+#endif
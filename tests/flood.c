@@ -0,0 +1,135 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+// Floods the player with property reads over the session bus and reports how long the replies took. Used by the test
+// suite to see that the main loop keeps serving D-Bus while it plays.
+//
+// USAGE: flood COUNT [WINDOW]
+// Sends COUNT Get calls, alternating between PlaybackStatus and Position, with at most WINDOW of them outstanding (all
+// of them at once by default), and prints one line of JSON with the reply latency percentiles in milliseconds.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <dbus/dbus.h>
+
+#define BUS_NAME "org.mpris.MediaPlayer2.tinyaudio"
+#define OBJ_PATH "/org/mpris/MediaPlayer2"
+#define IFACE_PLAYER "org.mpris.MediaPlayer2.Player"
+
+typedef struct {
+    int64_t sent;
+    int64_t replied;
+    int error;
+} call_t;
+
+static int outstanding;
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void replied(DBusPendingCall *pending, void *data) {
+    call_t *call = data;
+    call->replied = now_us();
+    DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+    call->error = !reply || dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR;
+    if (reply)
+        dbus_message_unref(reply);
+    dbus_pending_call_unref(pending);
+    outstanding--;
+}
+
+static int compare(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "USAGE: %s COUNT [WINDOW]\n", argv[0]);
+        return 2;
+    }
+    int count = atoi(argv[1]);
+    int window = argc > 2 ? atoi(argv[2]) : count;
+    if (count <= 0 || window <= 0) {
+        fprintf(stderr, "COUNT and WINDOW must be positive\n");
+        return 2;
+    }
+
+    DBusError err;
+    dbus_error_init(&err);
+    DBusConnection *conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (!conn) {
+        fprintf(stderr, "Failed to connect to the session bus: %s\n", err.message);
+        return 1;
+    }
+
+    call_t *calls = calloc(count, sizeof(call_t));
+    int64_t *latency = calloc(count, sizeof(int64_t));
+    if (!calls || !latency)
+        return 1;
+    const char *iface = IFACE_PLAYER;
+    const char *properties[] = {"PlaybackStatus", "Position"};
+    int64_t start = now_us();
+    for (int i = 0; i < count; i++) {
+        while (outstanding >= window)
+            dbus_connection_read_write_dispatch(conn, -1);
+        DBusMessage *msg = dbus_message_new_method_call(BUS_NAME, OBJ_PATH, DBUS_INTERFACE_PROPERTIES, "Get");
+        dbus_message_append_args(msg, DBUS_TYPE_STRING, &iface, DBUS_TYPE_STRING, &properties[i % 2],
+                                 DBUS_TYPE_INVALID);
+        DBusPendingCall *pending;
+        calls[i].sent = now_us();
+        if (!dbus_connection_send_with_reply(conn, msg, &pending, 10000) || !pending) {
+            calls[i].error = 1;
+            calls[i].replied = calls[i].sent;
+        } else {
+            outstanding++;
+            dbus_pending_call_set_notify(pending, replied, &calls[i], NULL);
+        }
+        dbus_message_unref(msg);
+    }
+    while (outstanding > 0)
+        dbus_connection_read_write_dispatch(conn, -1);
+    int64_t elapsed = now_us() - start;
+
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+        latency[i] = calls[i].replied - calls[i].sent;
+        errors += calls[i].error;
+    }
+    qsort(latency, count, sizeof(int64_t), compare);
+    printf("{\"count\": %d, \"errors\": %d, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+           "\"calls_per_second\": %.0f}\n",
+           count, errors, latency[count / 2] / 1000.0, latency[(count * 99) / 100] / 1000.0,
+           latency[count - 1] / 1000.0, count * 1000000.0 / elapsed);
+    free(calls);
+    free(latency);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+# MIT License
+#
+# Copyright (c) 2025
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Serves the files of a directory the way internet radio servers misbehave.
+
+USAGE: httpd.py DIR [PORT]
+Prints the port it listens on, then serves until killed. Plain requests get the file, with Range support. Query
+parameters turn a request into a live stream and break it:
+
+    live=1          no Content-Length, the stream ends when the file does
+    bps=N           bytes per second of audio, the rate a live stream is paced at (unpaced without it)
+    rate=X          send X times faster than real time
+    burst=S         send the first S seconds at once, as Icecast does on connect
+    stall=AT:LEN    stop sending for LEN seconds once AT seconds of audio went out
+    drop=AT         close the first connection to this URL once AT seconds of audio went out
+    icy=1           interleave ICY metadata when the client asks for it
+    title_every=S   change the ICY stream title every S seconds of audio
+"""
+
+import os
+import re
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+ICY_METAINT = 8192
+CHUNK = 4096
+TYPES = {".mp3": "audio/mpeg", ".aac": "audio/aac", ".flac": "audio/flac", ".opus": "audio/ogg",
+         ".ogg": "audio/ogg", ".wav": "audio/wav", ".m3u8": "application/vnd.apple.mpegurl", ".ts": "video/mp2t"}
+
+connections = {}
+connections_lock = threading.Lock()
+
+
+def streaming_wav(data):
+    """Marks the RIFF and data chunk sizes unknown, as a live WAV source would."""
+    data = bytearray(data)
+    data[4:8] = b"\xff\xff\xff\xff"
+    at = data.find(b"data", 12, 256)
+    if at >= 0:
+        data[at + 4:at + 8] = b"\xff\xff\xff\xff"
+    return bytes(data)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        url = urlsplit(self.path)
+        query = {k: v[-1] for k, v in parse_qs(url.query).items()}
+        path = os.path.join(self.server.root, os.path.basename(url.path))
+        try:
+            with open(path, "rb") as f:
+                data = f.read()
+        except OSError:
+            self.send_error(404)
+            return
+        with connections_lock:
+            nth = connections[self.path] = connections.get(self.path, 0) + 1
+        content_type = TYPES.get(os.path.splitext(path)[1], "application/octet-stream")
+        try:
+            if query.get("live"):
+                self.live(data, content_type, query, nth)
+            else:
+                self.file(data, content_type)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+    def file(self, data, content_type):
+        start, end = 0, len(data)
+        m = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        if m:
+            start = int(m.group(1))
+            end = min(end, int(m.group(2)) + 1) if m.group(2) else end
+            if start >= len(data):
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % len(data))
+                self.end_headers()
+                return
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end - 1, len(data)))
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(end - start))
+        self.send_header("Accept-Ranges", "bytes")
+        self.end_headers()
+        self.wfile.write(data[start:end])
+
+    def live(self, data, content_type, query, nth):
+        if content_type == "audio/wav":
+            data = streaming_wav(data)
+        bps = float(query.get("bps", 0))
+        rate = float(query.get("rate", 1))
+        burst = float(query.get("burst", 0))
+        stall_at, stall_len = (float(x) for x in query.get("stall", "-1:0").split(":"))
+        drop_at = float(query["drop"]) if "drop" in query and nth == 1 else -1
+        title_every = float(query.get("title_every", 0))
+        icy = query.get("icy") and self.headers.get("Icy-MetaData") == "1"
+
+        self.send_response(200)
+        self.send_header("Content-Type", content_type)
+        if icy:
+            self.send_header("icy-name", "tinyaudio test")
+            self.send_header("icy-metaint", str(ICY_METAINT))
+        self.end_headers()
+
+        sent = 0
+        until_meta = ICY_METAINT
+        title = None
+        start = time.monotonic()
+        stalled = False
+        while sent < len(data):
+            seconds = sent / bps if bps else 0
+            if 0 <= drop_at <= seconds:
+                return
+            if not stalled and 0 <= stall_at <= seconds:
+                time.sleep(stall_len)
+                start += stall_len
+                stalled = True
+            if bps:
+                # Audio goes out no earlier than it would be heard, less the burst.
+                wait = start + max(seconds - burst, 0) / rate - time.monotonic()
+                if wait > 0:
+                    time.sleep(wait)
+            n = min(CHUNK, len(data) - sent, until_meta if icy else CHUNK)
+            self.wfile.write(data[sent:sent + n])
+            sent += n
+            if not icy:
+                continue
+            until_meta -= n
+            if until_meta == 0:
+                until_meta = ICY_METAINT
+                current = "Title %d" % int(seconds / title_every) if title_every else "Title 0"
+                if current == title:
+                    self.wfile.write(b"\0")
+                else:
+                    title = current
+                    meta = ("StreamTitle='%s';" % title).encode()
+                    meta += b"\0" * (-len(meta) % 16)
+                    self.wfile.write(bytes([len(meta) // 16]) + meta)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    server = ThreadingHTTPServer(("127.0.0.1", int(sys.argv[2]) if len(sys.argv) > 2 else 0), Handler)
+    server.daemon_threads = True
+    server.root = sys.argv[1]
+    print(server.server_address[1], flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,728 @@
+#!/usr/bin/env python3
+# MIT License
+#
+# Copyright (c) 2025
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Runs the player against a private session bus and a misbehaving HTTP server.
+
+USAGE: run.py check | bench [--update]
+The player sends to an RTP monitor instead of PulseAudio (-n), which sees every packet with the time it is meant to be
+heard. Underruns show up as packets arriving after that time or as timeline restarts, dropouts as gaps in the
+presentation times or as silence inside the test tone, and Position is compared with what has been presented.
+
+bench measures decode speed per format and the D-Bus reply latency during playback, and fails on regressions against
+tests/baseline.json. Timings only compare well on the machine that recorded them, so the file keeps a baseline per
+host name, recorded with --update, next to a reference of generous bounds that any supported machine should meet and
+that hosts without a baseline of their own are held to. A result with no baseline to compare with fails.
+"""
+
+import array
+import json
+import math
+import os
+import re
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import wave
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD = os.path.join(ROOT, "build")
+TINYAUDIO = os.path.join(BUILD, "tinyaudio")
+FLOOD = os.path.join(BUILD, "flood")
+WORK = os.path.join(BUILD, "tests")
+HTTPD = os.path.join(ROOT, "tests", "httpd.py")
+BASELINE = os.path.join(ROOT, "tests", "baseline.json")
+
+BUS_NAME = "org.mpris.MediaPlayer2.tinyaudio"
+OBJ_PATH = "/org/mpris/MediaPlayer2"
+IFACE_PLAYER = "org.mpris.MediaPlayer2.Player"
+IFACE_TINYAUDIO = "org.mpris.MediaPlayer2.tinyaudio"
+
+SAMPLE_RATE = 44100
+DURATION = 20  # seconds of test tone
+TONE = 440
+RTP_FRAMES = 256
+PACKET_US = RTP_FRAMES * 1000000 / SAMPLE_RATE
+GAP_US = 20000  # a jump in presentation time or a run of silence this long is an audible gap
+SILENCE = 64  # peak sample value below which a packet counts as silent
+POSITION_TOLERANCE_MS = 50
+BURST_SECONDS = 15  # as in main.c
+BURST_LOW_WATERMARK = 5
+RESUME_MS = 1000  # from `tinyaudio play` to the first audio of a resumed track
+FLOOD_P99_MS = 50
+RTP_GROUP = "239.255.84.65"  # administratively scoped, so nothing leaves the host with the sender's TTL of 1
+RTP_SKEW_US = 5000  # receivers further apart than this are heard as an echo across rooms
+RTP_SETTLE = 3  # seconds receivers get to sync their clocks before they are measured
+TIMESHIFT_PAUSE = 3  # seconds a timeshifted stream is paused for
+SEEK_BACK_US = 2000000
+SPEED_REGRESSION = 0.8  # decode speed below this fraction of the baseline fails
+LATENCY_REGRESSION = (1.5, 1.0)  # reply latency above baseline * a + b ms fails
+
+ENCODINGS = [("mp3", ["-c:a", "libmp3lame", "-b:a", "128k"]),
+             ("aac", ["-c:a", "aac", "-b:a", "128k", "-f", "adts"]),
+             ("flac", ["-c:a", "flac"]),
+             ("opus", ["-c:a", "libopus", "-b:a", "96k"]),
+             # An HLS playlist must reach avformat as one stream, not be expanded into a tracklist of segments.
+             ("m3u8", ["-c:a", "aac", "-b:a", "128k", "-f", "hls", "-hls_time", "2", "-hls_list_size", "0",
+                       "-hls_segment_filename", os.path.join(WORK, "tone%d.ts")])]
+
+BUS_CONFIG = """<busconfig>
+  <type>session</type>
+  <listen>unix:tmpdir=%s</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+    <allow own="*"/>
+  </policy>
+</busconfig>
+"""
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+def make_fixtures():
+    """Writes the test tone as WAV and, where ffmpeg has the encoder, in every compressed format."""
+    os.makedirs(WORK, exist_ok=True)
+    wav = os.path.join(WORK, "tone.wav")
+    if not os.path.exists(wav):
+        step = 2 * math.pi * TONE / SAMPLE_RATE
+        samples = array.array("h", (int(16384 * math.sin(step * i)) for i in range(DURATION * SAMPLE_RATE)
+                                    for _ in range(2)))
+        if sys.byteorder == "big":
+            samples.byteswap()
+        with wave.open(wav + ".tmp", "wb") as w:
+            w.setnchannels(2)
+            w.setsampwidth(2)
+            w.setframerate(SAMPLE_RATE)
+            w.writeframes(samples.tobytes())
+        os.rename(wav + ".tmp", wav)
+    fixtures = {"wav": wav}
+    ffmpeg = shutil.which("ffmpeg")
+    for ext, args in ENCODINGS:
+        path = os.path.join(WORK, "tone." + ext)
+        if not os.path.exists(path) and ffmpeg:
+            tmp = os.path.join(WORK, "tmp." + ext)
+            if subprocess.run([ffmpeg, "-loglevel", "error", "-y", "-i", wav] + args + [tmp]).returncode == 0:
+                os.rename(tmp, path)
+        if os.path.exists(path):
+            fixtures[ext] = path
+        else:
+            print("SKIP %s fixture: %s" % (ext, "no encoder in ffmpeg" if ffmpeg else "no ffmpeg"))
+    return fixtures
+
+
+class Bus:
+    """A session bus of our own, so that the tests neither see nor disturb a running player."""
+
+    def __enter__(self):
+        self.dir = tempfile.mkdtemp(prefix="tinyaudio-bus-")
+        config = os.path.join(self.dir, "bus.conf")
+        with open(config, "w") as f:
+            f.write(BUS_CONFIG % self.dir)
+        self.proc = subprocess.Popen(["dbus-daemon", "--config-file=" + config, "--nofork", "--print-address=1"],
+                                     stdout=subprocess.PIPE, text=True)
+        self.address = self.proc.stdout.readline().strip()
+        if not self.address:
+            raise RuntimeError("dbus-daemon did not start")
+        self.env = dict(os.environ, DBUS_SESSION_BUS_ADDRESS=self.address, XDG_CACHE_HOME=self.dir,
+                        XDG_STATE_HOME=self.dir)
+        return self
+
+    def __exit__(self, *exc):
+        self.proc.terminate()
+        self.proc.wait()
+        shutil.rmtree(self.dir, ignore_errors=True)
+
+    def send(self, dest, path, iface, method, *args):
+        result = subprocess.run(["dbus-send", "--print-reply", "--dest=" + dest, path, iface + "." + method, *args],
+                                env=self.env, capture_output=True, text=True, timeout=10)
+        if result.returncode:
+            raise RuntimeError("%s failed: %s" % (method, result.stderr.strip()))
+        return result.stdout
+
+    def get(self, prop, iface=IFACE_PLAYER):
+        """Returns a property, parsed if it is a number or a string, as dbus-send prints it otherwise."""
+        out = self.send(BUS_NAME, OBJ_PATH, "org.freedesktop.DBus.Properties", "Get", "string:" + iface,
+                        "string:" + prop)
+        kind, value = (out.split("variant", 1)[-1].split(None, 1) + [""])[:2]
+        value = value.strip()
+        if kind == "string":
+            return value.strip('"')
+        if kind == "boolean":
+            return value == "true"
+        if kind == "double":
+            return float(value)
+        return int(value) if re.fullmatch(r"u?int\d+", kind) else out
+
+    def title(self):
+        m = re.search(r'"xesam:title"\s+variant\s+string "([^"]*)"', self.get("Metadata"))
+        return m and m.group(1)
+
+    def has_player(self):
+        out = self.send("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameHasOwner",
+                        "string:" + BUS_NAME)
+        return "boolean true" in out
+
+    def player_pid(self):
+        out = self.send("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                        "GetConnectionUnixProcessID", "string:" + BUS_NAME)
+        return int(out.split()[-1])
+
+
+class Pulse:
+    """A PulseAudio of our own with nothing but a null sink, for what the player only sends to a sound server."""
+
+    def __init__(self, bus):
+        self.bus = bus
+
+    def __enter__(self):
+        self.dir = tempfile.mkdtemp(prefix="tinyaudio-pulse-")
+        socket_path = os.path.join(self.dir, "native")
+        self.proc = subprocess.Popen(["pulseaudio", "-n", "--daemonize=no", "--use-pid-file=no", "--exit-idle-time=-1",
+                                      "-L", "module-null-sink",
+                                      "-L", "module-native-protocol-unix auth-anonymous=1 socket=" + socket_path],
+                                     env=dict(os.environ, XDG_RUNTIME_DIR=self.dir, HOME=self.dir),
+                                     stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        self.env = dict(self.bus.env, PULSE_SERVER="unix:" + socket_path)
+        deadline = time.monotonic() + 10
+        while not os.path.exists(socket_path):
+            if self.proc.poll() is not None or time.monotonic() > deadline:
+                self.__exit__()
+                raise RuntimeError("pulseaudio did not start")
+            time.sleep(0.05)
+        return self
+
+    def __exit__(self, *exc):
+        self.proc.terminate()
+        self.proc.wait()
+        shutil.rmtree(self.dir, ignore_errors=True)
+
+
+class RtpMonitor(threading.Thread):
+    """Receives what the player sends and keeps, per packet, when it arrived and when it is to be heard."""
+
+    def __init__(self):
+        super().__init__(daemon=True)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+        self.sock.bind(("127.0.0.1", 0))
+        self.sock.settimeout(0.1)
+        self.port = self.sock.getsockname()[1]
+        self.packets = []  # (arrival, seq, marker, play_at, generation, peak)
+        self.lock = threading.Lock()
+        self.stopped = False
+
+    def run(self):
+        while not self.stopped:
+            try:
+                buf = self.sock.recv(4096)
+            except socket.timeout:
+                continue
+            arrival = now_us()
+            if len(buf) < 28 or buf[0] & 0xdf != 0x90 or buf[1] & 0x7f != 10:
+                continue
+            words = struct.unpack(">H", buf[14:16])[0]
+            samples = array.array("h", buf[16 + 4 * words:])
+            if sys.byteorder == "little":
+                samples.byteswap()
+            peak = max(max(samples), -min(samples)) if samples else 0
+            seq, = struct.unpack(">H", buf[2:4])
+            play_at, generation = struct.unpack(">QI", buf[16:28])
+            with self.lock:
+                self.packets.append((arrival, seq, buf[1] >> 7, play_at, generation, peak))
+
+    def mark(self):
+        with self.lock:
+            return len(self.packets)
+
+    def window(self, start):
+        with self.lock:
+            return self.packets[start:]
+
+    def stop(self):
+        self.stopped = True
+        self.join()
+        self.sock.close()
+
+
+def analyze(packets):
+    stats = {"packets": len(packets), "late": 0, "lost": 0, "restarts": 0, "gaps": 0, "silences": 0}
+    audible = [i for i, p in enumerate(packets) if p[5] >= SILENCE]
+    silent_run = 0
+    for i, (arrival, seq, marker, play_at, generation, peak) in enumerate(packets):
+        stats["late"] += arrival > play_at
+        if i == 0:
+            continue
+        prev = packets[i - 1]
+        stats["lost"] += (seq - prev[1] - 1) % 65536
+        stats["restarts"] += marker
+        stats["gaps"] += play_at - prev[3] > PACKET_US + GAP_US
+        # Silence before the tone starts and after it ends is the codec's, not ours.
+        if audible and audible[0] < i < audible[-1] and peak < SILENCE:
+            silent_run += 1
+            stats["silences"] += silent_run * PACKET_US > GAP_US and (silent_run - 1) * PACKET_US <= GAP_US
+        else:
+            silent_run = 0
+    return stats
+
+
+def presented(packets, at):
+    """Seconds of audio heard by `at`."""
+    frames = 0
+    for p in packets:
+        if p[3] + PACKET_US <= at:
+            frames += RTP_FRAMES
+        elif p[3] < at:
+            frames += RTP_FRAMES * (at - p[3]) / PACKET_US
+    return frames / SAMPLE_RATE
+
+
+class Session:
+    """One run of the player on one URI, or on what it saved when it last quit, from start to Quit."""
+
+    def __init__(self, ctx, uri, *options, pulse=None):
+        self.ctx = ctx
+        self.bus = ctx.bus
+        self.uri = uri
+        self.options = options
+        self.pulse = pulse  # play to this sound server instead of the RTP monitor
+        self.positions = []  # (when, Position)
+
+    def __enter__(self):
+        self.start = self.ctx.monitor.mark()
+        self.started = now_us()
+        sink = [] if self.pulse else ["-n", "127.0.0.1:%d" % self.ctx.monitor.port]
+        cmd = [TINYAUDIO, *sink, *self.options, "play"]
+        cmd += [self.uri] if self.uri else []
+        # The player forks once it owns the bus name, so this returns as soon as it started.
+        if subprocess.run(cmd, env=self.pulse.env if self.pulse else self.bus.env, timeout=30).returncode:
+            raise RuntimeError("failed to start the player")
+        self.pid = self.bus.player_pid()
+        if self.pulse:
+            return self
+        deadline = time.monotonic() + 10
+        while not self.ctx.monitor.window(self.start):
+            if time.monotonic() > deadline:
+                raise RuntimeError("no audio within 10 s")
+            time.sleep(0.05)
+        return self
+
+    def __exit__(self, *exc):
+        try:
+            subprocess.run([TINYAUDIO, "quit"], env=self.bus.env, timeout=10)
+        except subprocess.TimeoutExpired:
+            pass
+        deadline = time.monotonic() + 5
+        while self.bus.has_player() and time.monotonic() < deadline:
+            time.sleep(0.05)
+        try:
+            os.kill(self.pid, 9)
+        except ProcessLookupError:
+            pass
+
+    def play_for(self, seconds, sample=None):
+        """Samples Position twice a second, and whatever else `sample` wants, while the player plays."""
+        end = time.monotonic() + seconds
+        while time.monotonic() < end:
+            before = now_us()
+            position = self.bus.get("Position")
+            self.positions.append(((before + now_us()) // 2, position))
+            if sample:
+                sample()
+            time.sleep(0.5)
+
+    def packets(self):
+        return self.ctx.monitor.window(self.start)
+
+    def position_error_ms(self):
+        packets = self.packets()
+        return max((abs(pos / 1e6 - presented(packets, at)) * 1000 for at, pos in self.positions), default=0)
+
+
+def clean(session, allow_restarts=False):
+    """Lists what went wrong with playback that should have gone without a hitch."""
+    stats = analyze(session.packets())
+    failures = []
+    if stats["packets"] == 0:
+        failures.append("no audio")
+    for key in ("late", "lost", "gaps", "silences") + (() if allow_restarts else ("restarts",)):
+        if stats[key]:
+            failures.append("%d %s" % (stats[key], key))
+    error = session.position_error_ms()
+    if error > POSITION_TOLERANCE_MS:
+        failures.append("Position off by %.0f ms" % error)
+    return failures, stats
+
+
+def still_playing(session, seconds=1.0):
+    """Whether audio kept coming until the end of the session."""
+    packets = session.packets()
+    return packets and now_us() - packets[-1][0] < seconds * 1e6 and session.bus.get("PlaybackStatus") == "Playing"
+
+
+class Context:
+    pass
+
+
+def live_uri(ctx, fixture, **params):
+    ext = os.path.splitext(fixture)[1]
+    params = dict(live=1, bps=int(os.path.getsize(fixture) / DURATION), **params)
+    query = "&".join("%s=%s" % kv for kv in params.items())
+    return "http://127.0.0.1:%d/tone%s?%s" % (ctx.http_port, ext, query)
+
+
+def check_file(ctx, fixture, uri):
+    with Session(ctx, uri) as s:
+        s.play_for(5)
+        return clean(s)
+
+
+def check_icy(ctx, fixture):
+    titles = set()
+    with Session(ctx, live_uri(ctx, fixture, burst=2, icy=1, title_every=1.5)) as s:
+        s.play_for(6, lambda: titles.add(s.bus.title()))
+        failures, stats = clean(s)
+    titles.discard(None)
+    if len(titles) < 2:
+        failures.append("saw titles %s, expected them to change" % sorted(titles))
+    return failures, stats
+
+
+def check_short_stall(ctx, fixture):
+    with Session(ctx, live_uri(ctx, fixture, burst=3, stall="2:1.5")) as s:
+        s.play_for(6)
+        return clean(s)
+
+
+def check_long_stall(ctx, fixture):
+    with Session(ctx, live_uri(ctx, fixture, burst=1, stall="2:3")) as s:
+        s.play_for(8)
+        stats = analyze(s.packets())
+        failures = [] if still_playing(s) else ["playback did not recover"]
+        return failures, stats
+
+
+def check_drop(ctx, fixture):
+    with Session(ctx, live_uri(ctx, fixture, burst=2, drop=2)) as s:
+        s.play_for(8)
+        stats = analyze(s.packets())
+        stats["reconnects"] = s.bus.get("ReconnectCount", IFACE_TINYAUDIO)
+        failures = [] if stats["reconnects"] else ["did not reconnect"]
+        if not still_playing(s):
+            failures.append("playback did not resume")
+        return failures, stats
+
+
+def check_resume(ctx, fixture, uri):
+    """Quits partway through and starts again with a bare `play`, which should pick up where it left off."""
+    with Session(ctx, uri) as s:
+        s.play_for(3)
+        left_at = s.bus.get("Position")
+    with Session(ctx, None) as s:
+        startup_ms = (s.packets()[0][0] - s.started) / 1000
+        s.play_for(1)
+        resumed_at = s.positions[0][1]
+        stats = analyze(s.packets())
+    stats.update(startup_ms=round(startup_ms), quit_at_ms=left_at // 1000, resumed_at_ms=resumed_at // 1000)
+    failures = []
+    # The first sample is taken once audio is flowing, so it may be a little ahead of where playback resumed.
+    if not left_at - 1000000 <= resumed_at <= left_at + 1500000:
+        failures.append("resumed at %.1f s after quitting at %.1f s" % (resumed_at / 1e6, left_at / 1e6))
+    if startup_ms > RESUME_MS:
+        failures.append("first audio after %.0f ms" % startup_ms)
+    return failures, stats
+
+
+def flood(ctx, count):
+    result = subprocess.run([FLOOD, str(count), "16"], env=ctx.bus.env, capture_output=True, text=True, timeout=60)
+    if not result.stdout:
+        raise RuntimeError("flood failed: " + result.stderr.strip())
+    return json.loads(result.stdout)
+
+
+def flood_failures(replies):
+    failures = []
+    if replies["errors"]:
+        failures.append("%d calls failed" % replies["errors"])
+    if replies["p99_ms"] > FLOOD_P99_MS:
+        failures.append("p99 reply latency %.1f ms" % replies["p99_ms"])
+    return failures
+
+
+def check_flood(ctx, fixture):
+    with Session(ctx, fixture) as s:
+        s.play_for(1)
+        replies = flood(ctx, 2000)
+        s.play_for(1)
+        failures, stats = clean(s)
+    stats.update(replies)
+    return failures + flood_failures(replies), stats
+
+
+def check_burst_flood(ctx, fixture):
+    """Floods a player in burst mode across a burst boundary, which is when it writes to the sink. Bursts only go to a
+    sound server, so this plays to a null sink of a PulseAudio of its own."""
+    if not shutil.which("pulseaudio"):
+        return None, {"skipped": "no pulseaudio"}
+    with Pulse(ctx.bus) as pulse, Session(ctx, fixture, "-b", pulse=pulse) as s:
+        # The first burst is written at once, the next once the sink is down to the low watermark.
+        time.sleep(1)
+        replies = flood(ctx, 2000)
+        replies_late = []
+        s.play_for(BURST_SECONDS - BURST_LOW_WATERMARK + 1, lambda: replies_late.append(flood(ctx, 200)))
+        stats = dict(replies, status=s.bus.get("PlaybackStatus"))
+    failures = flood_failures(replies) + [f for r in replies_late for f in flood_failures(r)]
+    if stats["status"] != "Playing":
+        failures.append("playback stopped")
+    return failures, stats
+
+
+def check_timeshift_stall(ctx, fixture):
+    """Floods a timeshifted player while it waits at the live edge of a stalled stream, where it waits for the reader
+    thread instead of the network."""
+    with Session(ctx, live_uri(ctx, fixture, burst=1, stall="3:3"), "-t") as s:
+        # The stall starts two seconds in, and the second of audio the player got ahead is gone a second later.
+        s.play_for(2.5)
+        replies = flood(ctx, 1000)
+        s.play_for(5)
+        stats = analyze(s.packets())
+        playing = still_playing(s)
+    stats.update(replies)
+    failures = flood_failures(replies)
+    if not playing:
+        failures.append("playback did not recover")
+    return failures, stats
+
+
+def check_timeshift_seek(ctx, fixture):
+    """Pauses a timeshifted live stream, resumes where it left off and seeks back into what was received meanwhile."""
+    with Session(ctx, live_uri(ctx, fixture, burst=2), "-t") as s:
+        s.play_for(2)
+        s.bus.send(BUS_NAME, OBJ_PATH, IFACE_PLAYER, "Pause")
+        paused_at = s.bus.get("Position")
+        time.sleep(TIMESHIFT_PAUSE)
+        s.bus.send(BUS_NAME, OBJ_PATH, IFACE_PLAYER, "Play")
+        resumed_at = s.bus.get("Position")
+        s.play_for(1)
+        delay = s.bus.get("TimeshiftDelay", IFACE_TINYAUDIO)
+        before = now_us(), s.bus.get("Position")
+        s.bus.send(BUS_NAME, OBJ_PATH, IFACE_PLAYER, "Seek", "int64:%d" % -SEEK_BACK_US)
+        time.sleep(0.5)
+        after = now_us(), s.bus.get("Position")
+        s.play_for(1)
+        stats = analyze(s.packets())
+        playing = still_playing(s)
+    expected = before[1] - SEEK_BACK_US + (after[0] - before[0])
+    stats.update(paused_at_ms=paused_at // 1000, resumed_at_ms=resumed_at // 1000, delay_ms=delay // 1000,
+                 seek_error_ms=abs(after[1] - expected) // 1000)
+    failures = []
+    if abs(resumed_at - paused_at) > 500000:
+        failures.append("resumed at %.1f s after pausing at %.1f s" % (resumed_at / 1e6, paused_at / 1e6))
+    if delay < (TIMESHIFT_PAUSE - 0.5) * 1e6:
+        failures.append("only %.1f s behind the live stream after a %d s pause" % (delay / 1e6, TIMESHIFT_PAUSE))
+    if abs(after[1] - expected) > 500000:
+        failures.append("seeking back went to %.1f s, expected %.1f s" % (after[1] / 1e6, expected / 1e6))
+    if not playing:
+        failures.append("playback did not continue")
+    return failures, stats
+
+
+def can_join(group):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton(group) + bytes(4))
+        return True
+    except OSError:
+        return False
+    finally:
+        sock.close()
+
+
+class Receiver:
+    """A `tinyaudio receive` playing to a sound server, keeping what it logs."""
+
+    def __init__(self, address, pulse):
+        self.proc = subprocess.Popen([TINYAUDIO, "receive", address], env=pulse.env, stderr=subprocess.PIPE,
+                                     text=True)
+        self.lines = []
+        self.thread = threading.Thread(target=lambda: self.lines.extend(self.proc.stderr), daemon=True)
+        self.thread.start()
+
+    def stop(self):
+        self.proc.terminate()
+        try:
+            self.proc.wait(5)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            self.proc.wait()
+        self.thread.join(5)
+
+    def heard(self):
+        """When each marked packet was heard, by sequence number."""
+        marks = (re.search(r"Packet (\d+) heard at (-?\d+) us", line) for line in self.lines)
+        return {int(m.group(1)): int(m.group(2)) for m in marks if m}
+
+
+def check_rtp_receivers(ctx, fixture):
+    """Streams to two receivers on this host, which play to a null sink, and compares the skew the sender reports with
+    how far apart the receivers say they heard the same packets."""
+    if not shutil.which("pulseaudio"):
+        return None, {"skipped": "no pulseaudio"}
+    if not can_join(RTP_GROUP):
+        return None, {"skipped": "no multicast route"}
+    probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    probe.bind(("", 0))
+    address = "%s:%d" % (RTP_GROUP, probe.getsockname()[1])
+    probe.close()
+    samples = []
+    with Pulse(ctx.bus) as pulse:
+        receivers = [Receiver(address, pulse) for _ in range(2)]
+        try:
+            with Session(ctx, fixture, "-n", address, pulse=pulse) as s:
+                time.sleep(RTP_SETTLE)
+                settled = time.monotonic() * 1e6  # receivers log CLOCK_MONOTONIC, as this is on Linux
+                s.play_for(6, lambda: samples.append((s.bus.get("RtpReceivers", IFACE_TINYAUDIO),
+                                                      s.bus.get("RtpSkew", IFACE_TINYAUDIO))))
+        finally:
+            for r in receivers:
+                r.stop()
+    heard = [r.heard() for r in receivers]
+    apart = [abs(at - heard[1][seq]) for seq, at in heard[0].items() if seq in heard[1] and at >= settled]
+    stats = {"receivers": max((n for n, _ in samples), default=0), "skew_us": max((k for _, k in samples), default=0),
+             "measured_skew_us": max(apart, default=0), "marks": len(apart)}
+    failures = []
+    if any(n != 2 for n, _ in samples):
+        failures.append("sender saw %s receivers" % sorted(set(n for n, _ in samples)))
+    if stats["skew_us"] > RTP_SKEW_US:
+        failures.append("RtpSkew up to %d us" % stats["skew_us"])
+    if not apart:
+        failures.append("receivers logged no packet in common")
+    elif stats["measured_skew_us"] > RTP_SKEW_US:
+        failures.append("receivers heard the same packet up to %d us apart" % stats["measured_skew_us"])
+    return failures, stats
+
+
+def check(ctx, fixtures):
+    # Live checks want a format whose few seconds of burst fit in socket buffers.
+    live_ext = "mp3" if "mp3" in fixtures else "wav"
+    live = fixtures[live_ext]
+    checks = []
+    for ext, path in fixtures.items():
+        checks.append(("file %s" % ext, check_file, path, path))
+        checks.append(("http %s" % ext, check_file, path, "http://127.0.0.1:%d/tone.%s" % (ctx.http_port, ext)))
+    checks.append(("live", check_file, live, live_uri(ctx, live, burst=2)))
+    checks += [("live icy", check_icy, live), ("short stall", check_short_stall, live),
+               ("long stall", check_long_stall, live), ("dropped connection", check_drop, live),
+               ("rtp receivers", check_rtp_receivers, fixtures["wav"]),
+               ("timeshift stall", check_timeshift_stall, live), ("timeshift seek", check_timeshift_seek, live),
+               ("d-bus flood", check_flood, fixtures["wav"]), ("burst d-bus flood", check_burst_flood, fixtures["wav"]),
+               ("resume file", check_resume, live, live),
+               ("resume http", check_resume, live, "http://127.0.0.1:%d/tone.%s" % (ctx.http_port, live_ext))]
+    failed = 0
+    for name, fn, *args in checks:
+        try:
+            failures, stats = fn(ctx, *args)
+        except Exception as e:
+            failures, stats = [str(e)], {}
+        failed += bool(failures)
+        verdict = "SKIP" if failures is None else "FAIL" if failures else "PASS"
+        print("%s %-20s %s" % (verdict, name, "; ".join(failures or []) or
+                               ", ".join("%s %s" % kv for kv in stats.items())), flush=True)
+    print("%d of %d checks failed" % (failed, len(checks)) if failed else "all %d checks passed" % len(checks))
+    return 1 if failed else 0
+
+
+def bench(ctx, fixtures, update):
+    out = subprocess.run([TINYAUDIO, "bench", *fixtures.values()], capture_output=True, text=True, check=True).stdout
+    results = {}
+    for line in out.splitlines()[1:]:
+        name, _, _, speed = line.split()
+        results["decode " + name] = float(speed.rstrip("x"))
+    with Session(ctx, fixtures["wav"]) as s:
+        s.play_for(1)
+        replies = flood(ctx, 5000)
+    results["reply p50 ms"] = replies["p50_ms"]
+    results["reply p99 ms"] = replies["p99_ms"]
+
+    with open(BASELINE) as f:
+        baselines = json.load(f)
+    host = socket.gethostname()
+    if update:
+        baselines.setdefault("hosts", {})[host] = results
+        with open(BASELINE, "w") as f:
+            json.dump(baselines, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("recorded the baseline of %s in %s" % (host, os.path.relpath(BASELINE, ROOT)))
+        return 0
+
+    # A host's own baseline gets the regression margins, the reference already is the bound.
+    own = baselines.get("hosts", {}).get(host)
+    baseline = own or baselines["reference"]
+    print("comparing with " + ("the baseline of " + host if own else "the reference, as %s has no baseline" % host))
+    failed = 0
+    for key, value in results.items():
+        base = baseline.get(key)
+        if base is None:
+            verdict = "NO BASELINE"
+        elif key.startswith("decode"):
+            verdict = "REGRESSED" if value < (base * SPEED_REGRESSION if own else base) else "ok"
+        else:
+            limit = base * LATENCY_REGRESSION[0] + LATENCY_REGRESSION[1] if own else base
+            verdict = "REGRESSED" if value > limit else "ok"
+        failed += verdict != "ok"
+        print("%-24s %10.3f %10s %s" % (key, value, "" if base is None else "%.3f" % base, verdict))
+    return 1 if failed else 0
+
+
+def main():
+    if len(sys.argv) < 2 or sys.argv[1] not in ("check", "bench"):
+        sys.exit(__doc__)
+    for tool in ("dbus-daemon", "dbus-send"):
+        if not shutil.which(tool):
+            sys.exit("%s is needed to run the tests" % tool)
+    fixtures = make_fixtures()
+    ctx = Context()
+    httpd = subprocess.Popen([sys.executable, HTTPD, WORK], stdout=subprocess.PIPE, text=True)
+    ctx.http_port = int(httpd.stdout.readline())
+    ctx.monitor = RtpMonitor()
+    ctx.monitor.start()
+    try:
+        with Bus() as ctx.bus:
+            if sys.argv[1] == "check":
+                return check(ctx, fixtures)
+            return bench(ctx, fixtures, "--update" in sys.argv[2:])
+    finally:
+        ctx.monitor.stop()
+        httpd.terminate()
+        httpd.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())